@@ -0,0 +1,575 @@
+/**
+ * @file
+ * @brief detfc̐\vx`}[NłB
+ *
+ * fBNgc[ɑ΂āAo^ĂSĂ̕ωoASY
+ * readDB, check, writeDBsAvԁAVXeR[AmېAőRSSJSONŏo͂܂B
+ */
+#define DETFC_NO_MAIN
+#include "../src/main.cpp"
+
+#include <new>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+
+#if defined(WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+
+
+// Allocation Counters
+
+namespace {
+
+std::atomic<std::uint64_t> allocationCount(0);
+std::atomic<std::uint64_t> allocatedBytes(0);
+
+void *countedAllocate(std::size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	if(void * const p = std::malloc(size ? size : 1)){
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+}//namespace
+
+void *operator new(std::size_t size) { return countedAllocate(size);}
+void *operator new[](std::size_t size) { return countedAllocate(size);}
+void operator delete(void *p) throw() { std::free(p);}
+void operator delete[](void *p) throw() { std::free(p);}
+// C++14 calls these when the size is known; without them the library's versions would free our blocks.
+void operator delete(void *p, std::size_t) throw() { std::free(p);}
+void operator delete[](void *p, std::size_t) throw() { std::free(p);}
+
+
+
+namespace {
+using namespace detfc;
+
+/**
+ * x`}[N̐ݒłB
+ */
+struct BenchOptions
+{
+	PathString dir; ///< c[ꏊ(̂ƂtmpfsꎞfBNg)
+	unsigned int fanout;
+	unsigned int depth;
+	unsigned int filesPerDirectory;
+	unsigned int maxFileSize;
+	std::vector<std::pair<PathString, unsigned int>> extensions; ///< gqƏd
+	double mutationRate;
+	unsigned int seed;
+	unsigned int repeat;
+	bool keep;
+	std::vector<std::string> methods; ///< ̂Ƃ͓o^ĂS
+	std::vector<std::string> detfcArgs; ///< --̌̈(detfcɂ̂܂ܓn܂)
+
+	BenchOptions()
+		: fanout(8), depth(3), filesPerDirectory(20), maxFileSize(256)
+		, mutationRate(0.01), seed(1), repeat(3), keep(false)
+	{}
+
+	bool parseExtensions(const std::string &spec)
+	{
+		extensions.clear();
+		std::istringstream iss(spec);
+		std::string item;
+		while(std::getline(iss, item, ',')){
+			const std::string::size_type colon = item.find(':');
+			const unsigned int weight = colon == std::string::npos ? 1 : std::strtoul(item.c_str() + colon + 1, nullptr, 10);
+			if(weight == 0){
+				return false;
+			}
+			extensions.push_back(std::make_pair(item.substr(0, colon), weight));
+		}
+		return !extensions.empty();
+	}
+
+	bool parse(int argc, char *argv[])
+	{
+		parseExtensions(".cpp:4,.h:2,.txt:1");
+		for(int i = 1; i < argc; ++i){
+			const std::string arg(argv[i]);
+			if(arg == "--"){
+				detfcArgs.assign(argv + i + 1, argv + argc);
+				break;
+			}
+			if(arg == "-keep"){
+				keep = true;
+				continue;
+			}
+			if(i + 1 == argc){
+				std::cerr << "Unknown option or missing value: " << arg << std::endl;
+				return false;
+			}
+			const char * const value = argv[++i];
+			if(arg == "-dir"){ dir = value;}
+			else if(arg == "-fanout"){ fanout = std::strtoul(value, nullptr, 10);}
+			else if(arg == "-depth"){ depth = std::strtoul(value, nullptr, 10);}
+			else if(arg == "-files"){ filesPerDirectory = std::strtoul(value, nullptr, 10);}
+			else if(arg == "-filesize"){ maxFileSize = std::strtoul(value, nullptr, 10);}
+			else if(arg == "-mutate"){ mutationRate = std::strtod(value, nullptr);}
+			else if(arg == "-seed"){ seed = std::strtoul(value, nullptr, 10);}
+			else if(arg == "-repeat"){ repeat = std::max(1ul, std::strtoul(value, nullptr, 10));}
+			else if(arg == "-m"){ methods.push_back(value);}
+			else if(arg == "-ext"){
+				if(!parseExtensions(value)){
+					std::cerr << "-ext <suffix[:weight]>[,...]" << std::endl;
+					return false;
+				}
+			}
+			else{
+				std::cerr << "Unknown option: " << arg << std::endl;
+				return false;
+			}
+		}
+		if(methods.empty()){
+			methods = CheckingMethodFactory::getDistinctMethodNames();
+		}
+		for(const std::string &method : methods){
+			if(!CheckingMethodFactory::getMethod(method)){
+				std::cerr << "Unknown checking method name '" << method << "' specified." << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+std::string escapeJSON(const std::string &s)
+{
+	std::string result;
+	for(const char c : s){
+		if(c == '"' || c == '\\'){
+			result += '\\';
+			result += c;
+		}
+		else if(static_cast<unsigned char>(c) < 0x20){
+			char buffer[8];
+			std::sprintf(buffer, "\\u%04x", static_cast<unsigned int>(c));
+			result += buffer;
+		}
+		else{
+			result += c;
+		}
+	}
+	return result;
+}
+
+PathString getDefaultBaseDirectory()
+{
+#if defined(WIN32)
+	const char * const temp = std::getenv("TEMP");
+	return temp ? temp : ".";
+#else
+	if(isPathDirectory("/dev/shm")){
+		return "/dev/shm"; // tmpfs keeps the disk out of the measurement
+	}
+	const char * const temp = std::getenv("TMPDIR");
+	return temp ? temp : "/tmp";
+#endif
+}
+
+/**
+ * dirƂ̉̑SĂ폜܂B
+ */
+void removeTree(const PathString &dir)
+{
+	std::vector<DirectoryEntry> entries;
+	for(DirectoryEntryEnumerator it(dir, FILEATTR_TYPE); !it.isEnd(); it.increment()){
+		entries.push_back(it.getEntry());
+	}
+	for(const DirectoryEntry &entry : entries){
+		if(entry.isDirectory()){
+			removeTree(entry.getPath());
+		}
+		else{
+			removeFile(entry.getPath());
+		}
+	}
+	removeDirectory(dir);
+}
+
+/**
+ * fBNgc[łB
+ */
+class SyntheticTree
+{
+	const BenchOptions &options_;
+	PathString root_;
+	std::mt19937 random_;
+	std::discrete_distribution<std::size_t> extensionDist_;
+	std::vector<PathString> directories_;
+	std::vector<PathString> files_;
+	unsigned int nextFileNumber_;
+public:
+	unsigned int modifiedCount;
+	unsigned int addedCount;
+	unsigned int deletedCount;
+
+	SyntheticTree(const BenchOptions &options, const PathString &root)
+		: options_(options), root_(root), random_(options.seed), nextFileNumber_(0)
+		, modifiedCount(0), addedCount(0), deletedCount(0)
+	{
+		std::vector<unsigned int> weights;
+		for(const auto &ext : options.extensions){
+			weights.push_back(ext.second);
+		}
+		extensionDist_ = std::discrete_distribution<std::size_t>(weights.begin(), weights.end());
+	}
+
+	const PathString &getRoot() const { return root_;}
+	std::size_t getDirectoryCount() const { return directories_.size();}
+	std::size_t getFileCount() const { return files_.size();}
+
+	bool generate()
+	{
+		return generateDirectory(root_, 0);
+	}
+
+	/**
+	 * t@ĈmutationRate̊AAǉA폜̂ꂩŕω܂B
+	 */
+	bool mutate()
+	{
+		const std::size_t count = static_cast<std::size_t>(files_.size() * options_.mutationRate + 0.5);
+		for(std::size_t i = 0; i < count && !files_.empty(); ++i){
+			const std::size_t index = std::uniform_int_distribution<std::size_t>(0, files_.size() - 1)(random_);
+			switch(std::uniform_int_distribution<int>(0, 2)(random_)){
+			case 0:
+				if(!writeFile(files_[index])){
+					return false;
+				}
+				++modifiedCount;
+				break;
+			case 1:
+				if(!addFile(getPathDirectoryPart(files_[index]))){
+					return false;
+				}
+				++addedCount;
+				break;
+			default:
+				if(!removeFile(files_[index])){
+					std::cerr << "t@C'" << files_[index] << "'폜ł܂łB" << std::endl;
+					return false;
+				}
+				files_[index] = files_.back();
+				files_.pop_back();
+				++deletedCount;
+				break;
+			}
+		}
+		return true;
+	}
+
+private:
+	bool generateDirectory(const PathString &dir, unsigned int level)
+	{
+		if(!createDirectory(dir)){
+			std::cerr << "fBNg'" << dir << "'쐬ł܂łB" << std::endl;
+			return false;
+		}
+		directories_.push_back(dir);
+		for(unsigned int i = 0; i < options_.filesPerDirectory; ++i){
+			if(!addFile(dir)){
+				return false;
+			}
+		}
+		if(level < options_.depth){
+			for(unsigned int i = 0; i < options_.fanout; ++i){
+				if(!generateDirectory(concatPath(dir, "d" + std::to_string(i)), level + 1)){
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	bool addFile(const PathString &dir)
+	{
+		const PathString path = concatPath(dir, "f" + std::to_string(nextFileNumber_++) + options_.extensions[extensionDist_(random_)].first);
+		if(!writeFile(path)){
+			return false;
+		}
+		files_.push_back(path);
+		return true;
+	}
+
+	bool writeFile(const PathString &path)
+	{
+		const std::size_t size = std::uniform_int_distribution<std::size_t>(0, options_.maxFileSize)(random_);
+		std::string content(size, '\0');
+		for(char &c : content){
+			c = static_cast<char>('a' + random_() % 26);
+		}
+		std::ofstream ofs(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if(!ofs.write(content.data(), content.size())){
+			std::cerr << "t@C'" << path << "'ɏ߂܂łB" << std::endl;
+			return false;
+		}
+		return true;
+	}
+};
+
+/**
+ * vJn_̃JE^łB
+ */
+class PhaseMeter
+{
+	std::chrono::steady_clock::time_point startTime_;
+	std::uint64_t startAllocations_;
+	std::uint64_t startAllocatedBytes_;
+	std::uint64_t startSystemCalls_[SYSCALL_COUNTER_COUNT];
+public:
+	PhaseMeter()
+		: startTime_(std::chrono::steady_clock::now())
+		, startAllocations_(allocationCount.load())
+		, startAllocatedBytes_(allocatedBytes.load())
+	{
+		for(int i = 0; i < SYSCALL_COUNTER_COUNT; ++i){
+			startSystemCalls_[i] = getSystemCallCount(static_cast<SystemCallCounter>(i));
+		}
+	}
+
+	/// Jn_̍JSOÑIuWFNgŕԂ܂B
+	std::string toJSON() const
+	{
+		const double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime_).count();
+		std::ostringstream oss;
+		oss << "{\"wallMs\": " << wallMs
+			<< ", \"allocations\": " << allocationCount.load() - startAllocations_
+			<< ", \"allocatedBytes\": " << allocatedBytes.load() - startAllocatedBytes_
+			<< ", \"syscalls\": {";
+		for(int i = 0; i < SYSCALL_COUNTER_COUNT; ++i){
+			const SystemCallCounter counter = static_cast<SystemCallCounter>(i);
+			oss << (i ? ", " : "") << "\"" << getSystemCallCounterName(counter) << "\": " << getSystemCallCount(counter) - startSystemCalls_[i];
+		}
+		oss << "}}";
+		return oss.str();
+	}
+};
+
+std::uint64_t getPeakRSSKiB()
+{
+#if defined(WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+	return GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)) ? pmc.PeakWorkingSetSize / 1024 : 0;
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0){
+		return 0;
+	}
+#if defined(__APPLE__)
+	return usage.ru_maxrss / 1024; // bytes
+#else
+	return usage.ru_maxrss; // KiB
+#endif
+#endif
+}
+
+/**
+ * detfcsƂƓ菇readDB, check, (KvȂ)writeDBsAʂJSONŕԂ܂B
+ */
+std::string measureRun(const std::string &method, const PathString &dbFile, const PathString &treeDir, const BenchOptions &options)
+{
+	std::vector<std::string> args = {"detfc", "-db", dbFile, "-r", "-m", method};
+	args.insert(args.end(), options.detfcArgs.begin(), options.detfcArgs.end());
+	args.push_back(treeDir);
+	std::vector<char *> argv;
+	for(std::string &arg : args){
+		argv.push_back(&arg[0]);
+	}
+	CommandLine cmdline;
+	if(!cmdline.parse(static_cast<int>(argv.size()), argv.data())){
+		return "\"error\": \"invalid detfc options\"";
+	}
+
+	OutputCapture capture; // -v output must not break the JSON
+	std::unique_ptr<CheckingMethod> checker(CheckingMethodFactory::getMethod(method)(cmdline));
+	const PhaseMeter total;
+
+	const PhaseMeter readPhase;
+	checker->readDB();
+	const std::string readJSON = readPhase.toJSON();
+
+	const PhaseMeter checkPhase;
+	const bool changed = checker->check();
+	const std::string checkJSON = checkPhase.toJSON();
+
+	const PhaseMeter writePhase;
+	const bool written = (changed || checker->isDBUpdateNeeded()) && cmdline.optWriteDB();
+	if(written){
+		checker->writeDB();
+	}
+	const std::string writeJSON = writePhase.toJSON();
+
+	std::ostringstream oss;
+	oss << "\"changed\": " << (changed ? "true" : "false")
+		<< ", \"dbWritten\": " << (written ? "true" : "false")
+		<< ", \"phases\": {\"readDB\": " << readJSON << ", \"check\": " << checkJSON << ", \"writeDB\": " << writeJSON << "}"
+		<< ", \"total\": " << total.toJSON()
+		<< ", \"peakRssKiB\": " << getPeakRSSKiB();
+	return oss.str();
+}
+
+/**
+ * measureRun()(ł)ʃvZXŎs܂BőRSSǑv̉e󂯂Ȃ悤ɂ邽߂łB
+ */
+std::string measureRunIsolated(const std::string &method, const PathString &dbFile, const PathString &treeDir, const BenchOptions &options)
+{
+#if defined(WIN32)
+	// No fork(); the peak working set is that of the whole benchmark so far.
+	return measureRun(method, dbFile, treeDir, options);
+#else
+	int fds[2];
+	if(pipe(fds) != 0){
+		return measureRun(method, dbFile, treeDir, options);
+	}
+	std::cout.flush();
+	std::cerr.flush();
+	const pid_t pid = fork();
+	if(pid < 0){
+		close(fds[0]);
+		close(fds[1]);
+		return measureRun(method, dbFile, treeDir, options);
+	}
+	if(pid == 0){
+		close(fds[0]);
+		const std::string result = measureRun(method, dbFile, treeDir, options);
+		for(std::size_t written = 0; written < result.size(); ){
+			const ssize_t n = write(fds[1], result.data() + written, result.size() - written);
+			if(n <= 0){
+				break;
+			}
+			written += n;
+		}
+		_exit(0); // skip the destructors and the buffers inherited from the parent
+	}
+	close(fds[1]);
+	std::string result;
+	char buffer[4096];
+	ssize_t n;
+	while((n = read(fds[0], buffer, sizeof(buffer))) > 0){
+		result.append(buffer, n);
+	}
+	close(fds[0]);
+	int status;
+	waitpid(pid, &status, 0);
+	if(result.empty()){
+		return "\"error\": \"measurement process failed\"";
+	}
+	return result;
+#endif
+}
+
+bool copyFile(const PathString &from, const PathString &to)
+{
+	std::ifstream ifs(from.c_str(), std::ios::in | std::ios::binary);
+	std::ofstream ofs(to.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if(!ifs){
+		return static_cast<bool>(ofs); // no DB (method 0) is copied as empty
+	}
+	ofs << ifs.rdbuf();
+	return static_cast<bool>(ofs);
+}
+
+}//namespace
+
+
+
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if(!options.parse(argc, argv)){
+		return EXIT_FAILURE;
+	}
+
+	const PathString workDir = concatPath(
+		options.dir.empty() ? getDefaultBaseDirectory() : options.dir,
+		"detfcbench-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+	if(!createDirectory(workDir)){
+		std::cerr << "fBNg'" << workDir << "'쐬ł܂łB" << std::endl;
+		return EXIT_FAILURE;
+	}
+	SyntheticTree tree(options, concatPath(workDir, "tree"));
+	bool succeeded = tree.generate();
+	const std::size_t generatedDirectoryCount = tree.getDirectoryCount();
+	const std::size_t generatedFileCount = tree.getFileCount();
+
+	std::vector<std::string> results;
+	const auto addResult = [&](const std::string &method, const char *scenario, unsigned int iteration, const std::string &measurement){
+		std::ostringstream oss;
+		oss << "{\"method\": \"" << escapeJSON(method) << "\", \"scenario\": \"" << scenario << "\", \"iteration\": " << iteration << ", " << measurement << "}";
+		results.push_back(oss.str());
+	};
+	const auto getDBFile = [&](const std::string &method){ return concatPath(workDir, method + ".db");};
+	const auto getSavedDBFile = [&](const std::string &method){ return concatPath(workDir, method + ".db.saved");};
+
+	// initial: no DB, unchanged: the DB matches the tree
+	for(const std::string &method : succeeded ? options.methods : std::vector<std::string>()){
+		addResult(method, "initial", 0, measureRunIsolated(method, getDBFile(method), tree.getRoot(), options));
+		for(unsigned int i = 0; i < options.repeat; ++i){
+			addResult(method, "unchanged", i, measureRunIsolated(method, getDBFile(method), tree.getRoot(), options));
+		}
+		copyFile(getDBFile(method), getSavedDBFile(method));
+	}
+	// mutated: each run starts from the unchanged DB; the DBs are restored before mutating
+	// so that the fast method sees the changes as newer than its DB.
+	for(unsigned int i = 0; succeeded && i < options.repeat; ++i){
+		for(const std::string &method : options.methods){
+			copyFile(getSavedDBFile(method), getDBFile(method));
+		}
+		// File times may be as coarse as the kernel tick; make the mutations strictly newer than the DBs.
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		if(!tree.mutate()){
+			succeeded = false;
+			break;
+		}
+		for(const std::string &method : options.methods){
+			addResult(method, "mutated", i, measureRunIsolated(method, getDBFile(method), tree.getRoot(), options));
+		}
+	}
+
+	std::cout << "{\n"
+		<< "  \"tree\": {\"dir\": \"" << escapeJSON(tree.getRoot()) << "\""
+		<< ", \"fanout\": " << options.fanout
+		<< ", \"depth\": " << options.depth
+		<< ", \"filesPerDirectory\": " << options.filesPerDirectory
+		<< ", \"maxFileSize\": " << options.maxFileSize
+		<< ", \"directories\": " << generatedDirectoryCount
+		<< ", \"files\": " << generatedFileCount
+		<< ", \"mutationRate\": " << options.mutationRate
+		<< ", \"modified\": " << tree.modifiedCount
+		<< ", \"added\": " << tree.addedCount
+		<< ", \"deleted\": " << tree.deletedCount
+		<< ", \"seed\": " << options.seed << "},\n"
+		<< "  \"detfcArgs\": [";
+	for(std::size_t i = 0; i < options.detfcArgs.size(); ++i){
+		std::cout << (i ? ", " : "") << "\"" << escapeJSON(options.detfcArgs[i]) << "\"";
+	}
+	std::cout << "],\n"
+		<< "  \"results\": [";
+	for(std::size_t i = 0; i < results.size(); ++i){
+		std::cout << (i ? ",\n    " : "\n    ") << results[i];
+	}
+	std::cout << "\n  ]\n}" << std::endl;
+
+	if(!options.keep){
+		removeTree(workDir);
+	}
+	return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <cstdint>
+#include "arena.h"
+
+namespace detfc{
+
+const std::size_t MonotonicArena::DEFAULT_BLOCK_SIZE;
+
+void *MonotonicArena::allocate(std::size_t size, std::size_t alignment)
+{
+	// blocks from new char[] are aligned for any fundamental type
+	const std::size_t padding = current_ ? (alignment - reinterpret_cast<std::uintptr_t>(current_) % alignment) % alignment : 0;
+	if(current_ == nullptr || size + padding > remaining_){
+		if(size > blockSize_ / 4){
+			// a large request gets its own block so that the current block is not wasted
+			blocks_.push_back(std::unique_ptr<char[]>(new char[size]));
+			allocatedSize_ += size;
+			return blocks_.back().get();
+		}
+		blocks_.push_back(std::unique_ptr<char[]>(new char[blockSize_]));
+		allocatedSize_ += blockSize_;
+		current_ = blocks_.back().get();
+		remaining_ = blockSize_;
+		char * const p = current_;
+		current_ += size;
+		remaining_ -= size;
+		return p;
+	}
+	char * const p = current_ + padding;
+	current_ = p + size;
+	remaining_ -= size + padding;
+	return p;
+}
+
+const PathChar *MonotonicArena::copyString(const PathChar *s, std::size_t length)
+{
+	if(length == 0){
+		return nullptr;
+	}
+	PathChar * const p = allocateArray<PathChar>(length);
+	std::char_traits<PathChar>::copy(p, s, length);
+	return p;
+}
+
+void MonotonicArena::absorb(MonotonicArena &other)
+{
+	if(&other == this){
+		return;
+	}
+	// Keep allocating from our own current block; other's partially used block is simply retired.
+	std::move(other.blocks_.begin(), other.blocks_.end(), std::back_inserter(blocks_));
+	allocatedSize_ += other.allocatedSize_;
+	other.blocks_.clear();
+	other.current_ = nullptr;
+	other.remaining_ = 0;
+	other.allocatedSize_ = 0;
+}
+
+void MonotonicArena::swap(MonotonicArena &other)
+{
+	blocks_.swap(other.blocks_);
+	std::swap(current_, other.current_);
+	std::swap(remaining_, other.remaining_);
+	std::swap(blockSize_, other.blockSize_);
+	std::swap(allocatedSize_, other.allocatedSize_);
+}
+
+void MonotonicArena::release()
+{
+	blocks_.clear();
+	current_ = nullptr;
+	remaining_ = 0;
+	allocatedSize_ = 0;
+}
+
+
+int PathSlice::compare(const PathSlice &rhs) const
+{
+	const std::size_t common = std::min(size, rhs.size);
+	const int order = common ? std::char_traits<PathChar>::compare(data, rhs.data, common) : 0;
+	if(order != 0){
+		return order;
+	}
+	return size < rhs.size ? -1 : size > rhs.size ? 1 : 0;
+}
+
+}//namespace detfc
@@ -0,0 +1,120 @@
+#ifndef DETFC_ARENA_H_INCLUDED
+#define DETFC_ARENA_H_INCLUDED
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <limits>
+#include <ostream>
+#include <type_traits>
+#include "filesystem.h"
+
+namespace detfc{
+
+/**
+ * mۂʂɂ͉Ȃ̈łB
+ *
+ * 傫ȃubN珇ɐ؂ôŁAȊmۂ𑽐sĂmۂ̉񐔂̓ubNłB
+ * Ŝrelease()fXgN^ňxɉ܂BubN͈ړȂ̂ŁAmۂ̈̃AhX͕ς܂B
+ * mۂ̈̃fXgN^͌Ă΂Ȃ̂ŁAɔjł^ɎgĂB
+ * XbhZ[tł͂܂([J[ɎAŌabsorb()ł܂Ƃ߂Ă)B
+ */
+class MonotonicArena
+{
+public:
+	static const std::size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+	explicit MonotonicArena(std::size_t blockSize = DEFAULT_BLOCK_SIZE)
+		: current_(nullptr), remaining_(0), blockSize_(blockSize), allocatedSize_(0) {}
+
+	void *allocate(std::size_t size, std::size_t alignment);
+	template<typename T>
+	T *allocateArray(std::size_t count)
+	{
+		return static_cast<T *>(allocate(sizeof(T) * count, std::alignment_of<T>::value));
+	}
+	/// 𕡐܂(I[͕t܂)B
+	const PathChar *copyString(const PathChar *s, std::size_t length);
+
+	/// other̃ubN܂Bothermۂ̈͂̂܂ܗLłB
+	void absorb(MonotonicArena &other);
+	void swap(MonotonicArena &other);
+	/// SẴubN܂B
+	void release();
+	std::size_t getAllocatedSize() const { return allocatedSize_;}
+
+private:
+	std::vector<std::unique_ptr<char[]>> blocks_;
+	char *current_;
+	std::size_t remaining_;
+	std::size_t blockSize_;
+	std::size_t allocatedSize_;
+
+	MonotonicArena(const MonotonicArena &);
+	MonotonicArena &operator=(const MonotonicArena &);
+};
+
+/**
+ * MonotonicArenamۂAP[^łBWReĩm[hȂǂɎg܂B
+ * deallocate()͉܂(̈̓A[iƋɉ܂)B
+ */
+template<typename T>
+class ArenaAllocator
+{
+	MonotonicArena *arena_;
+	template<typename U> friend class ArenaAllocator;
+public:
+	typedef T value_type;
+	typedef T *pointer;
+	typedef const T *const_pointer;
+	typedef T &reference;
+	typedef const T &const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+	template<typename U> struct rebind { typedef ArenaAllocator<U> other;};
+
+	explicit ArenaAllocator(MonotonicArena &arena) : arena_(&arena) {}
+	template<typename U> ArenaAllocator(const ArenaAllocator<U> &rhs) : arena_(rhs.arena_) {}
+
+	T *allocate(std::size_t n) { return arena_->allocateArray<T>(n);}
+	void deallocate(T *, std::size_t) {}
+	std::size_t max_size() const { return std::numeric_limits<std::size_t>::max() / sizeof(T);}
+	T *address(T &x) const { return &x;}
+	const T *address(const T &x) const { return &x;}
+	void construct(T *p, const T &v) { new(static_cast<void *>(p)) T(v);}
+	template<typename U, typename... Args> void construct(U *p, Args&&... args) { new(static_cast<void *>(p)) U(std::forward<Args>(args)...);}
+	template<typename U> void destroy(U *p) { p->~U();}
+
+	template<typename U> bool operator==(const ArenaAllocator<U> &rhs) const { return arena_ == rhs.arena_;}
+	template<typename U> bool operator!=(const ArenaAllocator<U> &rhs) const { return arena_ != rhs.arena_;}
+};
+
+/**
+ * A[iȂǂɒupX̎QƂł(I[͂܂)B
+ */
+struct PathSlice
+{
+	const PathChar *data;
+	std::size_t size;
+
+	PathString str() const { return PathString(data, size);}
+	int compare(const PathSlice &rhs) const;
+	bool operator<(const PathSlice &rhs) const { return compare(rhs) < 0;}
+	bool operator==(const PathSlice &rhs) const { return size == rhs.size && compare(rhs) == 0;}
+	bool operator!=(const PathSlice &rhs) const { return !operator==(rhs);}
+
+	static PathSlice of(const PathString &s) { const PathSlice slice = {s.data(), s.size()}; return slice;}
+	static PathSlice copy(MonotonicArena &arena, const PathChar *s, std::size_t length)
+	{
+		const PathSlice slice = {arena.copyString(s, length), length};
+		return slice;
+	}
+	static PathSlice copy(MonotonicArena &arena, const PathString &s) { return copy(arena, s.data(), s.size());}
+};
+inline std::ostream &operator<<(std::ostream &os, const PathSlice &s)
+{
+	return os.write(s.data, s.size);
+}
+
+}//namespace detfc
+#endif
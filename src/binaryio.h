@@ -3,6 +3,11 @@
 
 #include <istream>
 #include <ostream>
+#include <string>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include "arena.h"
 
 namespace detfc{
 
@@ -22,13 +27,13 @@ T readBinary(std::istream &is)
 	return v;
 }
 
-void writeStringBinary(std::ostream &os, std::string &v)
+inline void writeStringBinary(std::ostream &os, const std::string &v)
 {
 	writeBinary(os, v.size());
 	os.write(v.data(), v.size());
 }
 
-std::string readStringBinary(std::istream &is)
+inline std::string readStringBinary(std::istream &is)
 {
 	typedef char CHAR;
 	const std::size_t size = readBinary<std::size_t>(is);
@@ -51,5 +56,67 @@ std::string readStringBinary(std::istream &is)
 	}
 }
 
+inline void writeStringBinary(std::ostream &os, const PathSlice &v)
+{
+	writeBinary(os, v.size);
+	os.write(v.data, v.size);
+}
+
+/**
+ * arenaɓǂݍ݂܂B
+ */
+inline PathSlice readStringBinary(std::istream &is, MonotonicArena &arena)
+{
+	PathSlice slice = {nullptr, 0};
+	const std::size_t size = readBinary<std::size_t>(is);
+	if (!is || size == 0){
+		return slice;
+	}
+	PathChar * const buf = arena.allocateArray<PathChar>(size);
+	is.read(buf, size);
+	slice.data = buf;
+	slice.size = size;
+	return slice;
+}
+
+// Variable Length Integer (LEB128)
+
+inline void appendVarint(std::vector<char> &buf, std::uint64_t v)
+{
+	while(v >= 0x80){
+		buf.push_back(static_cast<char>((v & 0x7f) | 0x80));
+		v >>= 7;
+	}
+	buf.push_back(static_cast<char>(v));
+}
+
+inline std::uint64_t readVarint(const char *&p)
+{
+	std::uint64_t v = 0;
+	for(unsigned int shift = 0; ; shift += 7){
+		const unsigned char byte = static_cast<unsigned char>(*p++);
+		v |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+		if(!(byte & 0x80) || shift >= 63){
+			return v;
+		}
+	}
+}
+
+/**
+ * endzɓǂݍ݂܂Bend܂łɏIĂȂƂfalseԂ܂B
+ */
+inline bool readVarint(const char *&p, const char *end, std::uint64_t &v)
+{
+	v = 0;
+	for(unsigned int shift = 0; p != end; shift += 7){
+		const unsigned char byte = static_cast<unsigned char>(*p++);
+		v |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+		if(!(byte & 0x80) || shift >= 63){
+			return true;
+		}
+	}
+	return false;
+}
+
 }//namespace detfc
 #endif
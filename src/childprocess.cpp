@@ -0,0 +1,214 @@
+#include <vector>
+#include "childprocess.h"
+#include "filesystem.h"
+
+#if !defined(WIN32)
+#include <spawn.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+extern char **environ;
+#else
+#include <cstdlib>
+#endif
+
+namespace detfc{
+
+bool ChildProcess::needsShell(const std::string &command)
+{
+	// Anything the shell would interpret, including quotes, variables and VAR=value prefixes.
+	return command.find_first_not_of(" \t") == std::string::npos
+		|| command.find_first_of("|&;<>()$`\\\"'*?[]#~=%{}!\n") != std::string::npos;
+}
+
+#if !defined(WIN32)
+
+// --------------------------------------------------------
+// ChildProcess (posix_spawn)
+// --------------------------------------------------------
+
+ChildProcess::ChildProcess(const std::string &command)
+	: command_(command)
+	, started_(false)
+	, pid_(-1)
+	, inputFd_(-1)
+{}
+
+ChildProcess::~ChildProcess()
+{
+	if(started_){
+		wait();
+	}
+}
+
+bool ChildProcess::start(bool pipesInput)
+{
+	std::vector<std::string> args;
+	if(needsShell(command_)){
+		args.push_back("/bin/sh");
+		args.push_back("-c");
+		args.push_back(command_);
+	}
+	else{
+		for(std::string::size_type pos = command_.find_first_not_of(" \t"); pos != std::string::npos; ){
+			const std::string::size_type end = command_.find_first_of(" \t", pos);
+			args.push_back(command_.substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+			pos = command_.find_first_not_of(" \t", end);
+		}
+	}
+	std::vector<char *> argv;
+	for(std::string &arg : args){
+		argv.push_back(&arg[0]);
+	}
+	argv.push_back(nullptr);
+
+	int pipeFds[2] = {-1, -1};
+	if(pipesInput && ::pipe2(pipeFds, O_CLOEXEC) != 0){
+		return false;
+	}
+	posix_spawn_file_actions_t actions;
+	::posix_spawn_file_actions_init(&actions);
+	if(pipesInput){
+		::posix_spawn_file_actions_adddup2(&actions, pipeFds[0], STDIN_FILENO);
+	}
+	pid_t pid;
+	const int result = ::posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+	::posix_spawn_file_actions_destroy(&actions);
+	if(pipesInput){
+		::close(pipeFds[0]);
+	}
+	if(result != 0){
+		if(pipesInput){
+			::close(pipeFds[1]);
+		}
+		return false;
+	}
+	pid_ = pid;
+	inputFd_ = pipeFds[1];
+	started_ = true;
+	return true;
+}
+
+bool ChildProcess::writeInput(const char *data, std::size_t size)
+{
+	if(inputFd_ == -1){
+		return false;
+	}
+	// Block SIGPIPE while writing so that a command which exits without reading does not kill detfc,
+	// and discard the signal raised here (but not one that was already pending).
+	sigset_t pipeSignal;
+	sigemptyset(&pipeSignal);
+	sigaddset(&pipeSignal, SIGPIPE);
+	sigset_t pending;
+	sigpending(&pending);
+	const bool wasPending = sigismember(&pending, SIGPIPE) == 1;
+	sigset_t oldMask;
+	::pthread_sigmask(SIG_BLOCK, &pipeSignal, &oldMask);
+	const bool written = writeFileDescriptor(inputFd_, data, size);
+	if(!written && errno == EPIPE && !wasPending){
+		const struct timespec noWait = {0, 0};
+		while(::sigtimedwait(&pipeSignal, nullptr, &noWait) == -1 && errno == EINTR){}
+	}
+	::pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+	if(!written){
+		closeInput();
+	}
+	return written;
+}
+
+void ChildProcess::closeInput()
+{
+	if(inputFd_ != -1){
+		::close(inputFd_);
+		inputFd_ = -1;
+	}
+}
+
+int ChildProcess::wait()
+{
+	if(!started_){
+		return -1;
+	}
+	closeInput();
+	started_ = false;
+	int status;
+	while(::waitpid(pid_, &status, 0) == -1){
+		if(errno != EINTR){
+			return -1;
+		}
+	}
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+#else
+
+// --------------------------------------------------------
+// ChildProcess (cmd.exe)
+// --------------------------------------------------------
+
+ChildProcess::ChildProcess(const std::string &command)
+	: command_(command)
+	, started_(false)
+	, input_(nullptr)
+	, status_(-1)
+{}
+
+ChildProcess::~ChildProcess()
+{
+	if(started_){
+		wait();
+	}
+}
+
+bool ChildProcess::start(bool pipesInput)
+{
+	if(pipesInput){
+		input_ = ::_popen(command_.c_str(), "wb");
+		if(!input_){
+			return false;
+		}
+	}
+	else{
+		status_ = std::system(command_.c_str());
+	}
+	started_ = true;
+	return true;
+}
+
+bool ChildProcess::writeInput(const char *data, std::size_t size)
+{
+	if(!input_){
+		return false;
+	}
+	return std::fwrite(data, 1, size, input_) == size;
+}
+
+void ChildProcess::closeInput()
+{
+	// _pclose() closes the pipe and waits at once, so the input is only flushed here.
+	if(input_){
+		std::fflush(input_);
+	}
+}
+
+int ChildProcess::wait()
+{
+	if(!started_){
+		return -1;
+	}
+	started_ = false;
+	if(input_){
+		status_ = ::_pclose(input_);
+		input_ = nullptr;
+	}
+	return status_;
+}
+
+#endif
+
+}//namespace detfc
@@ -0,0 +1,58 @@
+#ifndef DETFC_CHILDPROCESS_H_INCLUDED
+#define DETFC_CHILDPROCESS_H_INCLUDED
+
+#include <string>
+#include <cstdio>
+
+namespace detfc{
+
+/**
+ * -ẽR}hsqvZXłB
+ *
+ * POSIXłposix_spawnŋN܂BVF̋@\(_CNgAϐApȂ)gĂȂR}h́A
+ * 󔒂ŋ؂ăVFɒڎsAłȂ/bin/sh -cŎs܂B
+ * Windowsł͏]ʂVF(cmd.exe)Ŏs܂BW͂pCvɂȂƂstart()̒ŏI܂ő҂܂B
+ */
+class ChildProcess
+{
+public:
+	explicit ChildProcess(const std::string &command);
+	/// N܂܂ȂAW͂ďI҂܂B
+	~ChildProcess();
+
+	/**
+	 * R}hN܂BpipesInput̂Ƃ͕W͂pCvɂāAwriteInput()ŏ߂悤ɂ܂B
+	 * NłȂƂfalseԂ܂B
+	 */
+	bool start(bool pipesInput);
+	const std::string &getCommand() const { return command_;}
+	bool isStarted() const { return started_;}
+	/**
+	 * W͂ɏ݂܂B
+	 * R}hW͂(ǂ܂ɏI)falseԂAȍ~͉݂܂B
+	 */
+	bool writeInput(const char *data, std::size_t size);
+	void closeInput();
+	/// W͂ďI҂AIXe[^XԂ܂(VOiŏIƂȂǂ-1)B
+	int wait();
+
+	/// commandVFĎsKv邩ǂԂ܂B
+	static bool needsShell(const std::string &command);
+
+private:
+	std::string command_;
+	bool started_;
+#if defined(WIN32)
+	std::FILE *input_; ///< _popen()̌
+	int status_; ///< pCvɂȂƂstd::system()̌
+#else
+	int pid_;
+	int inputFd_;
+#endif
+
+	ChildProcess(const ChildProcess &);
+	ChildProcess &operator=(const ChildProcess &);
+};
+
+}//namespace detfc
+#endif
@@ -0,0 +1,315 @@
+#include <cstring>
+#include "contenthash.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace detfc{
+
+// --------------------------------------------------------
+// XXH64
+// --------------------------------------------------------
+
+namespace {
+
+const std::uint64_t PRIME64_1 = 0x9E3779B185EBCA87ull;
+const std::uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+const std::uint64_t PRIME64_3 = 0x165667B19E3779F9ull;
+const std::uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+const std::uint64_t PRIME64_5 = 0x27D4EB2F165667C5ull;
+
+inline std::uint64_t rotl64(std::uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+inline std::uint64_t read64(const unsigned char *p)
+{
+	std::uint64_t v;
+	std::memcpy(&v, p, sizeof(v)); // little endian only
+	return v;
+}
+inline std::uint32_t read32(const unsigned char *p)
+{
+	std::uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+inline std::uint64_t round64(std::uint64_t acc, std::uint64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+inline std::uint64_t mergeRound64(std::uint64_t acc, std::uint64_t val)
+{
+	acc ^= round64(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+}//namespace
+
+void XXH64State::reset(std::uint64_t seed)
+{
+	seed_ = seed;
+	v_[0] = seed + PRIME64_1 + PRIME64_2;
+	v_[1] = seed + PRIME64_2;
+	v_[2] = seed;
+	v_[3] = seed - PRIME64_1;
+	totalLength_ = 0;
+	bufferSize_ = 0;
+}
+
+void XXH64State::update(const void *data, std::size_t length)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	const unsigned char * const end = p + length;
+	totalLength_ += length;
+
+	if(bufferSize_ + length < 32){
+		std::memcpy(buffer_ + bufferSize_, p, length);
+		bufferSize_ += length;
+		return;
+	}
+	if(bufferSize_ > 0){
+		const std::size_t fill = 32 - bufferSize_;
+		std::memcpy(buffer_ + bufferSize_, p, fill);
+		p += fill;
+		for(int i = 0; i < 4; ++i){
+			v_[i] = round64(v_[i], read64(buffer_ + i * 8));
+		}
+		bufferSize_ = 0;
+	}
+	while(end - p >= 32){
+		v_[0] = round64(v_[0], read64(p));
+		v_[1] = round64(v_[1], read64(p + 8));
+		v_[2] = round64(v_[2], read64(p + 16));
+		v_[3] = round64(v_[3], read64(p + 24));
+		p += 32;
+	}
+	if(p < end){
+		bufferSize_ = end - p;
+		std::memcpy(buffer_, p, bufferSize_);
+	}
+}
+
+std::uint64_t XXH64State::digest() const
+{
+	std::uint64_t h;
+	if(totalLength_ >= 32){
+		h = rotl64(v_[0], 1) + rotl64(v_[1], 7) + rotl64(v_[2], 12) + rotl64(v_[3], 18);
+		for(int i = 0; i < 4; ++i){
+			h = mergeRound64(h, v_[i]);
+		}
+	}
+	else{
+		h = seed_ + PRIME64_5;
+	}
+	h += totalLength_;
+
+	const unsigned char *p = buffer_;
+	const unsigned char * const end = buffer_ + bufferSize_;
+	while(end - p >= 8){
+		h ^= round64(0, read64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+	if(end - p >= 4){
+		h ^= static_cast<std::uint64_t>(read32(p)) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	while(p < end){
+		h ^= (*p++) * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+
+// --------------------------------------------------------
+// ContentHasher
+// --------------------------------------------------------
+
+const std::size_t ContentHasher::DEFAULT_BUFFER_SIZE;
+const std::size_t ContentHasher::BUFFER_ALIGNMENT;
+
+ContentHasher::ContentHasher(std::size_t bufferSize)
+	: memory_(new char[bufferSize + BUFFER_ALIGNMENT])
+	, buffer_(nullptr)
+	, bufferSize_(bufferSize)
+{
+	const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(memory_.get());
+	buffer_ = memory_.get() + (BUFFER_ALIGNMENT - address % BUFFER_ALIGNMENT) % BUFFER_ALIGNMENT;
+}
+
+#if !defined(WIN32)
+bool ContentHasher::hashFile(const PathString &path, ContentHash &hash)
+{
+	// O_NONBLOCK keeps a FIFO that slipped in after the scan from blocking the open itself.
+	countSystemCall(SYSCALL_FILE_OPEN);
+	const int fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if(fd == -1){
+		return false;
+	}
+	struct stat st;
+	if(::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+		::close(fd);
+		return false;
+	}
+	XXH64State state;
+	bool succeeded = true;
+	for(;;){
+		countSystemCall(SYSCALL_FILE_READ);
+		const ssize_t size = ::read(fd, buffer_, bufferSize_);
+		if(size < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			succeeded = false;
+			break;
+		}
+		if(size == 0){
+			break;
+		}
+		state.update(buffer_, static_cast<std::size_t>(size));
+	}
+	::close(fd);
+	if(!succeeded){
+		return false;
+	}
+	hash = state.digest();
+	return true;
+}
+#else
+bool ContentHasher::hashFile(const PathString &path, ContentHash &hash)
+{
+	countSystemCall(SYSCALL_FILE_OPEN);
+	const HANDLE handle = ::CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(handle == INVALID_HANDLE_VALUE){
+		return false;
+	}
+	if(::GetFileType(handle) != FILE_TYPE_DISK){ // pipes and devices
+		::CloseHandle(handle);
+		return false;
+	}
+	XXH64State state;
+	bool succeeded = true;
+	for(;;){
+		countSystemCall(SYSCALL_FILE_READ);
+		DWORD size = 0;
+		if(!::ReadFile(handle, buffer_, static_cast<DWORD>(bufferSize_), &size, NULL)){
+			succeeded = false;
+			break;
+		}
+		if(size == 0){
+			break;
+		}
+		state.update(buffer_, size);
+	}
+	::CloseHandle(handle);
+	if(!succeeded){
+		return false;
+	}
+	hash = state.digest();
+	return true;
+}
+#endif
+
+
+
+// --------------------------------------------------------
+// ContentHashPipeline
+// --------------------------------------------------------
+
+const std::size_t ContentHashPipeline::NO_JOB;
+
+ContentHashPipeline::ContentHashPipeline(unsigned int threadCount, std::size_t queueCapacity)
+	: queueCapacity_(queueCapacity)
+	, closed_(false)
+{
+	if(threadCount == 0){
+		threadCount = 1;
+	}
+	for(unsigned int i = 0; i < threadCount; ++i){
+		threads_.push_back(std::thread(&ContentHashPipeline::run, this));
+	}
+}
+
+ContentHashPipeline::~ContentHashPipeline()
+{
+	finish();
+}
+
+std::size_t ContentHashPipeline::submit(const PathString &path)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while(queue_.size() >= queueCapacity_){
+		queueNotFull_.wait(lock);
+	}
+	Job job;
+	job.path = path;
+	job.hash = 0;
+	job.succeeded = false;
+	jobs_.push_back(job);
+	queue_.push_back(&jobs_.back()); // deque::push_back keeps references valid
+	queueNotEmpty_.notify_one();
+	return jobs_.size() - 1;
+}
+
+void ContentHashPipeline::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		closed_ = true;
+	}
+	queueNotEmpty_.notify_all();
+	for(std::thread &t : threads_){
+		t.join();
+	}
+	threads_.clear();
+}
+
+bool ContentHashPipeline::getResult(std::size_t job, ContentHash &hash) const
+{
+	if(job >= jobs_.size() || !jobs_[job].succeeded){
+		return false;
+	}
+	hash = jobs_[job].hash;
+	return true;
+}
+
+void ContentHashPipeline::run()
+{
+	ContentHasher hasher;
+	for(;;){
+		Job *job;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			while(queue_.empty() && !closed_){
+				queueNotEmpty_.wait(lock);
+			}
+			if(queue_.empty()){
+				return; // closed
+			}
+			job = queue_.front();
+			queue_.pop_front();
+			queueNotFull_.notify_one();
+		}
+		job->succeeded = hasher.hashFile(job->path, job->hash);
+	}
+}
+
+}//namespace detfc
@@ -0,0 +1,94 @@
+#ifndef DETFC_CONTENTHASH_H_INCLUDED
+#define DETFC_CONTENTHASH_H_INCLUDED
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "filesystem.h"
+
+namespace detfc{
+
+typedef std::uint64_t ContentHash;
+
+/**
+ * XXH64 (xxHash 64bit)̃Xg[vZłB
+ */
+class XXH64State
+{
+	std::uint64_t v_[4];
+	std::uint64_t totalLength_;
+	unsigned char buffer_[32];
+	std::size_t bufferSize_;
+	std::uint64_t seed_;
+public:
+	explicit XXH64State(std::uint64_t seed = 0) { reset(seed);}
+	void reset(std::uint64_t seed = 0);
+	void update(const void *data, std::size_t length);
+	std::uint64_t digest() const;
+};
+
+/**
+ * t@C̓ẽnbVl߂܂B
+ *
+ * ̃obt@(y[WEɑ)g񂷂̂ŁAIuWFNgő̃t@CƌIłB
+ */
+class ContentHasher
+{
+	std::unique_ptr<char[]> memory_;
+	char *buffer_;
+	std::size_t bufferSize_;
+public:
+	static const std::size_t DEFAULT_BUFFER_SIZE = 256 * 1024;
+	static const std::size_t BUFFER_ALIGNMENT = 4096;
+	explicit ContentHasher(std::size_t bufferSize = DEFAULT_BUFFER_SIZE);
+	/// ʏ̃t@CłȂ(FIFOfoCXȂ)Aǂݍ܂falseԂ܂B
+	bool hashFile(const PathString &path, ContentHash &hash);
+};
+
+/**
+ * t@C̓ǂݍ݂ƃnbVvZɍspCvCłB
+ *
+ * submit()Ńt@C𓊓ƁAǂݍ݁EnbVvZXbh܂B
+ * eXbh͎pContentHasher(obt@)g񂵂܂B
+ * L[͗LŁAt̂Ƃsubmit()͋󂫂ł܂ő҂܂B
+ * finish()őSĂ̏̊҂ĂAgetResult()ŌʂoĂB
+ */
+class ContentHashPipeline
+{
+	struct Job
+	{
+		PathString path;
+		ContentHash hash;
+		bool succeeded;
+	};
+	std::deque<Job> jobs_;
+	std::deque<Job *> queue_;
+	const std::size_t queueCapacity_;
+	std::mutex mutex_;
+	std::condition_variable queueNotEmpty_;
+	std::condition_variable queueNotFull_;
+	bool closed_;
+	std::vector<std::thread> threads_;
+public:
+	static const std::size_t NO_JOB = ~static_cast<std::size_t>(0);
+	explicit ContentHashPipeline(unsigned int threadCount, std::size_t queueCapacity = 1024);
+	~ContentHashPipeline();
+
+	/// ẽnbVvZ˗܂BXbhZ[tłB߂lgetResult()ɓnԍłB
+	std::size_t submit(const PathString &path);
+	/// SĂ̈˗̏I܂ő҂܂B
+	void finish();
+	bool getResult(std::size_t job, ContentHash &hash) const;
+private:
+	ContentHashPipeline(const ContentHashPipeline &);
+	ContentHashPipeline &operator=(const ContentHashPipeline &);
+	void run();
+};
+
+}//namespace detfc
+#endif
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <string>
+#include "entrystore.h"
+
+namespace detfc{
+
+namespace {
+
+typedef std::char_traits<PathChar> PathCharTraits;
+
+/**
+ * ̒fЂȂɔr܂B
+ */
+int compareConcatenated(
+	const PathChar *a1, std::size_t n1, const PathChar *a2, std::size_t n2,
+	const PathChar *b1, std::size_t m1, const PathChar *b2, std::size_t m2)
+{
+	for(;;){
+		if(n1 == 0){
+			a1 = a2; n1 = n2; n2 = 0;
+		}
+		if(m1 == 0){
+			b1 = b2; m1 = m2; m2 = 0;
+		}
+		if(n1 == 0 || m1 == 0){
+			return (n1 == 0 ? 0 : 1) - (m1 == 0 ? 0 : 1);
+		}
+		const std::size_t n = std::min(n1, m1);
+		const int order = PathCharTraits::compare(a1, b1, n);
+		if(order != 0){
+			return order;
+		}
+		a1 += n; n1 -= n;
+		b1 += n; m1 -= n;
+	}
+}
+
+}//namespace
+
+EntryStore::DirectoryRef EntryStore::internDirectory(const PathString &dir)
+{
+	const PathString prefix = getPathChildPrefix(dir);
+	return store(prefix.data(), prefix.size());
+}
+
+EntryStore::Entry EntryStore::makeEntry(DirectoryRef dir, const PathString &name, FileType type, FileSize size, FileTime lastWriteTime)
+{
+	Entry entry;
+	entry.prefix = dir;
+	entry.name = store(name.data(), name.size());
+	entry.type = type;
+	entry.size = size;
+	entry.lastWriteTime = lastWriteTime;
+	return entry;
+}
+
+EntryStore::Entry EntryStore::makeEntry(const PathString &path, FileType type, FileSize size, FileTime lastWriteTime)
+{
+	Entry entry;
+	entry.prefix = store(path.data(), path.size());
+	entry.name.data = entry.prefix.data + entry.prefix.size;
+	entry.name.size = 0;
+	entry.type = type;
+	entry.size = size;
+	entry.lastWriteTime = lastWriteTime;
+	return entry;
+}
+
+EntryStore::Slice EntryStore::storePath(const Entry &entry)
+{
+	if(entry.name.size == 0){
+		return entry.prefix;
+	}
+	PathChar * const p = arena_.allocateArray<PathChar>(entry.prefix.size + entry.name.size);
+	PathCharTraits::copy(p, entry.prefix.data, entry.prefix.size);
+	PathCharTraits::copy(p + entry.prefix.size, entry.name.data, entry.name.size);
+	const Slice slice = {p, entry.prefix.size + entry.name.size};
+	return slice;
+}
+
+EntryStore::Entry EntryStore::copyEntry(const Entry &entry, PrefixMap &prefixes)
+{
+	Entry copy = entry;
+	const auto it = prefixes.find(entry.prefix.data);
+	if(it != prefixes.end() && it->second.size == entry.prefix.size){
+		copy.prefix = it->second;
+	}
+	else{
+		copy.prefix = store(entry.prefix.data, entry.prefix.size);
+		prefixes[entry.prefix.data] = copy.prefix;
+	}
+	copy.name = store(entry.name.data, entry.name.size);
+	return copy;
+}
+
+int EntryStore::comparePath(const Entry &a, const Entry &b)
+{
+	if(a.prefix.data == b.prefix.data && a.prefix.size == b.prefix.size){
+		// same directory: only the names differ
+		return compareConcatenated(a.name.data, a.name.size, nullptr, 0, b.name.data, b.name.size, nullptr, 0);
+	}
+	return compareConcatenated(
+		a.prefix.data, a.prefix.size, a.name.data, a.name.size,
+		b.prefix.data, b.prefix.size, b.name.data, b.name.size);
+}
+
+int EntryStore::comparePath(const Entry &a, const PathString &b)
+{
+	return compareConcatenated(
+		a.prefix.data, a.prefix.size, a.name.data, a.name.size,
+		b.data(), b.size(), nullptr, 0);
+}
+
+}//namespace detfc
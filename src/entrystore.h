@@ -0,0 +1,91 @@
+#ifndef DETFC_ENTRYSTORE_H_INCLUDED
+#define DETFC_ENTRYSTORE_H_INCLUDED
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include "filesystem.h"
+#include "arena.h"
+
+namespace detfc{
+
+/**
+ * ŏW߂Gg̃pXAȂmۂŕێ̈łB
+ *
+ * MonotonicArenaɊmۂAʂɂ͉܂(AhX͕ςȂ̂ŎQƂ͖ɂȂ܂)B
+ * fBNg͎q̃pX̑Oɕt镔(getPathChildPrefix)xi[A
+ * eGg͂̈ʒuƃt@C̈ʒu܂B
+ * pXKvȂƂ́AĂяog񂷃obt@ɑgݗĂ܂B
+ */
+class EntryStore
+{
+public:
+	typedef PathSlice Slice;
+	typedef Slice DirectoryRef;
+
+	/**
+	 * i[GgłBpXprefix + namełB
+	 */
+	struct Entry
+	{
+		Slice prefix;
+		Slice name;
+		FileType type;
+		FileSize size;
+		FileTime lastWriteTime;
+
+		bool isRegularFile() const { return type == FILETYPE_REGULAR;}
+		bool isDirectory() const { return type == FILETYPE_DIRECTORY;}
+	};
+
+	EntryStore() {}
+
+	/// fBNgdiri[܂Bdir̒̃Gg͂gmakeEntry()ĂB
+	DirectoryRef internDirectory(const PathString &dir);
+	/// dir̒nameƂÕGg܂B
+	Entry makeEntry(DirectoryRef dir, const PathString &name, FileType type, FileSize size, FileTime lastWriteTime);
+	/// pXpath̃Gg܂(R}hCŎw肳ꂽpX̂悤ɁAfBNgLȂ)B
+	Entry makeEntry(const PathString &path, FileType type, FileSize size, FileTime lastWriteTime);
+	/// entry擾ăGg܂B
+	Entry makeEntry(DirectoryRef dir, const DirectoryEntry &entry)
+	{
+		return makeEntry(dir, entry.getFilename(), entry.getFileType(), entry.getFileSize(), entry.getLastWriteTime());
+	}
+
+	/// Gg̃pXŜ̗̈Ɋi[܂B
+	Slice storePath(const Entry &entry);
+	/// ̈ɑ̎̓f[^uƂɎg܂B
+	MonotonicArena &getArena() { return arena_;}
+
+	typedef std::unordered_map<const PathChar *, Slice> PrefixMap; ///< prefix.data => prefix
+	/// entrÿ̗ɕ܂BfBNg̃GgprefixesʂĕprefixL܂B
+	Entry copyEntry(const Entry &entry, PrefixMap &prefixes);
+	/// other̃ubN܂Bother̃Gg͂̂܂ܗLłB
+	void absorb(EntryStore &other) { arena_.absorb(other.arena_);}
+	void swap(EntryStore &other) { arena_.swap(other.arena_);}
+	std::size_t getAllocatedSize() const { return arena_.getAllocatedSize();}
+
+	/// Gg̃pXbufferɑgݗĂĕԂ܂B
+	static const PathString &buildPath(const Entry &entry, PathString &buffer)
+	{
+		buffer.assign(entry.prefix.data, entry.prefix.size);
+		buffer.append(entry.name.data, entry.name.size);
+		return buffer;
+	}
+	/// pXgݗĂɔr܂(PathString̑召֌WƓł)B
+	static int comparePath(const Entry &a, const Entry &b);
+	static int comparePath(const Entry &a, const PathString &b);
+
+private:
+	MonotonicArena arena_;
+
+	EntryStore(const EntryStore &);
+	EntryStore &operator=(const EntryStore &);
+
+	Slice store(const PathChar *s, std::size_t size) { return PathSlice::copy(arena_, s, size);}
+};
+
+}//namespace detfc
+#endif
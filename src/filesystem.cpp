@@ -2,6 +2,9 @@
 
 #include <windows.h>
 #include <tchar.h>
+#include <io.h>
+#include <vector>
+#include <algorithm>
 #include "filesystem.h"
 
 namespace {
@@ -136,6 +139,67 @@ typedef is_char_or_char_pred<PATH_CHAR_L('\\'), PATH_CHAR_L('/')> is_separator;
 typedef is_char_pred<PATH_CHAR_L('.')> is_dot;
 
 
+// --------------------------------------------------------
+// Output File
+// --------------------------------------------------------
+
+class OutputFile
+{
+	HANDLE handle_;
+public:
+	OutputFile() : handle_(INVALID_HANDLE_VALUE) {}
+	~OutputFile() { close();}
+	bool create(const PathString &p)
+	{
+		countSystemCall(SYSCALL_FILE_OPEN);
+		handle_ = ::CreateFile(p.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		return handle_ != INVALID_HANDLE_VALUE;
+	}
+	void copyPermissionsFrom(const PathString &) {} // the new file inherits the directory's ACL
+	bool write(const char *data, std::size_t size)
+	{
+		while(size > 0){
+			const DWORD chunk = static_cast<DWORD>(size < 0x40000000 ? size : 0x40000000);
+			DWORD written = 0;
+			countSystemCall(SYSCALL_FILE_WRITE);
+			if(!::WriteFile(handle_, data, chunk, &written, NULL)){
+				return false;
+			}
+			data += written;
+			size -= written;
+		}
+		return true;
+	}
+	bool sync()
+	{
+		return ::FlushFileBuffers(handle_) != FALSE;
+	}
+	void close()
+	{
+		if(handle_ != INVALID_HANDLE_VALUE){
+			::CloseHandle(handle_);
+			handle_ = INVALID_HANDLE_VALUE;
+		}
+	}
+};
+
+PathString getTemporaryPathFor(const PathString &p)
+{
+	TCHAR pid[32];
+	wsprintf(pid, _T("%lu"), ::GetCurrentProcessId());
+	return p + PATH_CHAR_L(".tmp") + pid;
+}
+PathString resolveFileLink(const PathString &p)
+{
+	return p; // MoveFileEx replaces a symbolic link itself; links are not followed on Windows
+}
+bool replaceFile(const PathString &src, const PathString &dst)
+{
+	return ::MoveFileEx(src.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+}
+
+
+
 }//namespace
 
 
@@ -212,6 +276,11 @@ PathString::size_type getPathFileNamePos(const PathString &s)
 	return afterSep;
 }
 
+PathString::size_type findPathSeparator(const PathString &s, PathString::size_type pos)
+{
+	return find_first_char(s, is_separator(), pos);
+}
+
 /**
  * pX̃t@CԂ܂B
  * Ō̃pX؂蕶ȍ~Ԃ܂B
@@ -306,6 +375,28 @@ PathString concatPath(const PathString &a, const PathString &b)
 	}
 }
 
+PathString getPathChildPrefix(const PathString &dir)
+{
+	if(dir.empty() || isPathTerminatedByRedundantSeparator(dir)){
+		return dir;
+	}
+	return dir + PATH_CHAR_L("\\");
+}
+
+/**
+ * pconcatPath(dir, ...)ōdir̉̃pXǂԂ܂B
+ */
+bool isPathUnderDirectory(const PathString &p, const PathString &dir)
+{
+	if(dir.empty()){
+		return !p.empty();
+	}
+	const std::size_t prefixLength = isPathTerminatedByRedundantSeparator(dir) ? dir.size() : dir.size() + 1;
+	return p.size() > prefixLength
+		&& p.compare(0, dir.size(), dir) == 0
+		&& (prefixLength == dir.size() || is_separator()(p[dir.size()]));
+}
+
 
 // --------------------------------------------------------
 // File Operation
@@ -313,6 +404,7 @@ PathString concatPath(const PathString &a, const PathString &b)
 
 FileType getPathFileType(const PathString &p)
 {
+	countSystemCall(SYSCALL_STAT);
 	return win32FileType(::GetFileAttributes(p.c_str()));
 }
 
@@ -329,9 +421,10 @@ bool isPathRegularFile(const PathString &p)
 	return getPathFileType(p) == FILETYPE_REGULAR;
 }
 
-DirectoryEntry getPathDirectoryEntry(const PathString &p)
+DirectoryEntry getPathDirectoryEntry(const PathString &p, FileAttributeMask /*wantedAttributes*/)
 {
 	WIN32_FILE_ATTRIBUTE_DATA data;
+	countSystemCall(SYSCALL_STAT);
 	if(!GetFileAttributesEx(p.c_str(), GetFileExInfoStandard, &data)){
 		return DirectoryEntry(
 			getPathDirectoryPart(p),
@@ -349,6 +442,7 @@ DirectoryEntry getPathDirectoryEntry(const PathString &p)
 FileTime getPathLastWriteTime(const PathString &p)
 {
 	WIN32_FILE_ATTRIBUTE_DATA data;
+	countSystemCall(SYSCALL_STAT);
 	if(!GetFileAttributesEx(p.c_str(), GetFileExInfoStandard, &data)){
 		return 0;
 	}
@@ -358,12 +452,82 @@ FileTime getPathLastWriteTime(const PathString &p)
 FileTime getPathFileSize(const PathString &p)
 {
 	WIN32_FILE_ATTRIBUTE_DATA data;
+	countSystemCall(SYSCALL_STAT);
 	if(!GetFileAttributesEx(p.c_str(), GetFileExInfoStandard, &data)){
 		return 0;
 	}
 	return win32FileSize(data.nFileSizeLow, data.nFileSizeHigh);
 }
 
+FileTime getCurrentFileTime()
+{
+	FILETIME ft;
+	::GetSystemTimeAsFileTime(&ft);
+	return win32FileTime(ft);
+}
+
+FileTime getFileTimeTicksPerSecond()
+{
+	return 10000000u; // 100ns
+}
+
+double getProcessCPUTime()
+{
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	if(!::GetProcessTimes(::GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)){
+		return 0;
+	}
+	return static_cast<double>(win32FileTime(kernelTime) + win32FileTime(userTime)) / getFileTimeTicksPerSecond();
+}
+
+PathString getCurrentDirectory()
+{
+	const DWORD length = ::GetCurrentDirectory(0, nullptr);
+	if(length == 0){
+		return PathString();
+	}
+	std::vector<PathChar> buffer(length);
+	if(::GetCurrentDirectory(length, buffer.data()) == 0){
+		return PathString();
+	}
+	return PathString(buffer.data());
+}
+
+bool setCurrentDirectory(const PathString &p)
+{
+	return ::SetCurrentDirectory(p.c_str()) != FALSE;
+}
+
+bool createDirectory(const PathString &p)
+{
+	return ::CreateDirectory(p.c_str(), NULL) != FALSE;
+}
+
+bool removeDirectory(const PathString &p)
+{
+	return ::RemoveDirectory(p.c_str()) != FALSE;
+}
+
+bool removeFile(const PathString &p)
+{
+	return ::DeleteFile(p.c_str()) != FALSE;
+}
+
+bool writeFileDescriptor(int fd, const char *data, std::size_t size)
+{
+	while(size > 0){
+		const unsigned int chunk = static_cast<unsigned int>(std::min<std::size_t>(size, 1024 * 1024 * 1024));
+		countSystemCall(SYSCALL_FILE_WRITE);
+		const int written = ::_write(fd, data, chunk);
+		if(written <= 0){
+			return false;
+		}
+		data += written;
+		size -= static_cast<std::size_t>(written);
+	}
+	return true;
+}
+
 
 
 
@@ -377,12 +541,13 @@ class DirectoryEntryEnumerator::Impl
 	WIN32_FIND_DATA data_;
 	DirectoryEntry entry_;
 public:
-	explicit Impl(const PathString &dir)
+	Impl(const PathString &dir, FileAttributeMask /*wantedAttributes*/)
 		: handle_(INVALID_HANDLE_VALUE)
 		, entry_(dir, PathString(), FILETYPE_ERROR, 0, 0)
 	{
 		const PathString asterisk( PATH_CHAR_L("*") );
 		const PathString searchPath = concatPath(dir, asterisk);
+		countSystemCall(SYSCALL_DIRECTORY_OPEN);
 		handle_ = ::FindFirstFile(searchPath.c_str(), &data_);
 		makeEntry();
 	}
@@ -428,6 +593,7 @@ private:
 	void next()
 	{
 		if(isValid()){
+			countSystemCall(SYSCALL_DIRECTORY_READ);
 			if(!::FindNextFile(handle_, &data_)){
 				close();
 			}
@@ -436,17 +602,1238 @@ private:
 };
 
 
-DirectoryEntryEnumerator::DirectoryEntryEnumerator(const PathString &dir) : impl_(new Impl(dir)) {}
+DirectoryEntryEnumerator::DirectoryEntryEnumerator(const PathString &dir, FileAttributeMask wantedAttributes, const PrefetchFilter &/*prefetch*/) : impl_(new Impl(dir, wantedAttributes)) {} // FindNextFile already has the attributes
 DirectoryEntryEnumerator::~DirectoryEntryEnumerator() {}
 bool DirectoryEntryEnumerator::isEnd() const {return !impl_->isValid();}
 const DirectoryEntry &DirectoryEntryEnumerator::getEntry() const { return impl_->getEntry();}
 void DirectoryEntryEnumerator::increment() {impl_->increment();}
 
+void DirectoryEntry::loadAttributes(FileAttributeMask attrs) const
+{
+	// FindFirstFile and GetFileAttributesEx always give all attributes.
+	loadedAttributes_ |= attrs;
+}
+
+
+
+// --------------------------------------------------------
+// MappedFile
+// --------------------------------------------------------
+
+class MappedFile::Impl
+{
+	HANDLE file_;
+	HANDLE mapping_;
+	const char *data_;
+	std::size_t size_;
+public:
+	explicit Impl(const PathString &p)
+		: file_(INVALID_HANDLE_VALUE)
+		, mapping_(NULL)
+		, data_(NULL)
+		, size_(0)
+	{
+		countSystemCall(SYSCALL_FILE_OPEN);
+		file_ = ::CreateFile(p.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if(file_ == INVALID_HANDLE_VALUE){
+			return;
+		}
+		LARGE_INTEGER size;
+		if(!::GetFileSizeEx(file_, &size) || size.QuadPart == 0 || static_cast<ULONGLONG>(size.QuadPart) > static_cast<std::size_t>(-1)){
+			return;
+		}
+		mapping_ = ::CreateFileMapping(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(mapping_ == NULL){
+			return;
+		}
+		data_ = static_cast<const char *>(::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+		if(data_){
+			size_ = static_cast<std::size_t>(size.QuadPart);
+		}
+	}
+	~Impl()
+	{
+		if(data_){
+			::UnmapViewOfFile(data_);
+		}
+		if(mapping_ != NULL){
+			::CloseHandle(mapping_);
+		}
+		if(file_ != INVALID_HANDLE_VALUE){
+			::CloseHandle(file_);
+		}
+	}
+	bool isValid() const { return data_ != NULL;}
+	const char *getData() const { return data_;}
+	std::size_t getSize() const { return size_;}
+};
+
+MappedFile::MappedFile() {}
+MappedFile::~MappedFile() {}
+bool MappedFile::open(const PathString &p)
+{
+	impl_.reset(new Impl(p));
+	if(!impl_->isValid()){
+		impl_.reset();
+		return false;
+	}
+	return true;
+}
+void MappedFile::close() { impl_.reset();}
+bool MappedFile::isOpen() const { return impl_ != nullptr;}
+const char *MappedFile::getData() const { return impl_ ? impl_->getData() : nullptr;}
+std::size_t MappedFile::getSize() const { return impl_ ? impl_->getSize() : 0;}
+
 }//namespace detfc
 
 #endif //defined(WIN32)
 
 
 #if !defined(WIN32)
-//#include <unistd.h>
-#endif //!defined(WIN32)
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <mutex>
+#include <atomic>
+#include "filesystem.h"
+
+namespace {
+using namespace detfc;
+
+// --------------------------------------------------------
+// Type Conversion
+// --------------------------------------------------------
+
+FileType posixFileType(mode_t mode)
+{
+	if(S_ISDIR(mode)){
+		return FILETYPE_DIRECTORY;
+	}
+	if(S_ISREG(mode)){
+		return FILETYPE_REGULAR;
+	}
+	return FILETYPE_OTHER;
+}
+FileTime posixFileTime(const struct timespec &ts)
+{
+	return static_cast<FileTime>(ts.tv_sec) * 1000000000u + static_cast<FileTime>(ts.tv_nsec);
+}
+FileTime posixFileTime(const struct statx_timestamp &ts)
+{
+	return static_cast<FileTime>(ts.tv_sec) * 1000000000u + static_cast<FileTime>(ts.tv_nsec);
+}
+
+// --------------------------------------------------------
+// Attribute Query
+// --------------------------------------------------------
+
+struct FileAttributes
+{
+	FileType type;
+	FileSize size;
+	FileTime lastWriteTime;
+};
+
+bool fstatatAttributes(int dirfd, const char *path, FileAttributes &attrs)
+{
+	struct stat st;
+	countSystemCall(SYSCALL_STAT);
+	if(::fstatat(dirfd, path, &st, 0) != 0){
+		return false;
+	}
+	attrs.type = posixFileType(st.st_mode);
+	attrs.size = st.st_size;
+	attrs.lastWriteTime = posixFileTime(st.st_mtim);
+	return true;
+}
+
+/**
+ * path̑̂maskŎw肵̂擾܂B
+ *
+ * statxgꍇ͎w肳ꂽv܂B
+ */
+bool queryAttributes(int dirfd, const char *path, FileAttributeMask mask, FileAttributes &attrs)
+{
+	// set once by whichever -j worker sees ENOSYS first
+	static std::atomic<bool> statxUnsupported(false);
+	if(!statxUnsupported.load(std::memory_order_relaxed)){
+		unsigned int statxMask = 0;
+		if(mask & FILEATTR_TYPE){ statxMask |= STATX_TYPE;}
+		if(mask & FILEATTR_SIZE){ statxMask |= STATX_SIZE;}
+		if(mask & FILEATTR_LAST_WRITE_TIME){ statxMask |= STATX_MTIME;}
+
+		struct statx stx;
+		countSystemCall(SYSCALL_STAT);
+		if(::statx(dirfd, path, AT_STATX_SYNC_AS_STAT, statxMask, &stx) == 0){
+			attrs.type = (stx.stx_mask & STATX_TYPE) ? posixFileType(stx.stx_mode) : FILETYPE_ERROR;
+			attrs.size = (stx.stx_mask & STATX_SIZE) ? stx.stx_size : 0;
+			attrs.lastWriteTime = (stx.stx_mask & STATX_MTIME) ? posixFileTime(stx.stx_mtime) : 0;
+			return true;
+		}
+		if(errno != ENOSYS){
+			return false;
+		}
+		statxUnsupported.store(true, std::memory_order_relaxed); // old kernel
+	}
+	return fstatatAttributes(dirfd, path, attrs);
+}
+
+// --------------------------------------------------------
+// Batched Attribute Query
+// --------------------------------------------------------
+
+/**
+ * statx܂Ƃ߂Ĕsio_uringłB
+ *
+ * liburing͎g킸AVXeR[ŒڃO𑀍삵܂B
+ * L[͓L[2{̂ŁAɔŝgetCapacity()܂łɂĂ(܂)B
+ * ̃O𓯎Ɏĝ͈̗񋓎qł(StatxRingPool؂܂)B
+ */
+class StatxRing
+{
+	static const unsigned int ENTRIES = 128;
+
+	int fd_;
+	unsigned int capacity_;
+	void *sqRing_;
+	std::size_t sqRingSize_;
+	void *cqRing_;
+	std::size_t cqRingSize_;
+	struct io_uring_sqe *sqes_;
+	std::size_t sqesSize_;
+	unsigned int *sqTail_;
+	unsigned int sqMask_;
+	unsigned int *sqArray_;
+	unsigned int *cqHead_;
+	unsigned int *cqTail_;
+	unsigned int cqMask_;
+	struct io_uring_cqe *cqes_;
+	unsigned int unsubmitted_;
+public:
+	StatxRing()
+		: fd_(-1), capacity_(0)
+		, sqRing_(MAP_FAILED), sqRingSize_(0), cqRing_(MAP_FAILED), cqRingSize_(0)
+		, sqes_(static_cast<struct io_uring_sqe *>(MAP_FAILED)), sqesSize_(0)
+		, unsubmitted_(0)
+	{
+		struct io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+		fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, ENTRIES, &params));
+		if(fd_ < 0){
+			fd_ = -1; // no io_uring (old kernel, seccomp, io_uring_disabled)
+			return;
+		}
+		sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+		cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+		sqRing_ = ::mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+		cqRing_ = ::mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+		sqes_ = static_cast<struct io_uring_sqe *>(::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+		if(sqRing_ == MAP_FAILED || cqRing_ == MAP_FAILED || sqes_ == MAP_FAILED){
+			release();
+			return;
+		}
+		char * const sq = static_cast<char *>(sqRing_);
+		char * const cq = static_cast<char *>(cqRing_);
+		sqTail_ = reinterpret_cast<unsigned int *>(sq + params.sq_off.tail);
+		sqMask_ = *reinterpret_cast<unsigned int *>(sq + params.sq_off.ring_mask);
+		sqArray_ = reinterpret_cast<unsigned int *>(sq + params.sq_off.array);
+		cqHead_ = reinterpret_cast<unsigned int *>(cq + params.cq_off.head);
+		cqTail_ = reinterpret_cast<unsigned int *>(cq + params.cq_off.tail);
+		cqMask_ = *reinterpret_cast<unsigned int *>(cq + params.cq_off.ring_mask);
+		cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+		capacity_ = params.sq_entries;
+	}
+	~StatxRing()
+	{
+		release();
+	}
+	bool isValid() const { return fd_ != -1;}
+	unsigned int getCapacity() const { return capacity_;}
+	/// ς񂾂܂sĂȂv̐łB
+	unsigned int getUnsubmittedCount() const { return unsubmitted_;}
+
+	/// dirfd̑΃pXpathstatxς݂܂BssubmitAndWait()ōs܂B
+	void prepareStatx(int dirfd, const char *path, struct statx *buffer, std::uint64_t userData)
+	{
+		const unsigned int tail = *sqTail_; // only this thread writes the tail
+		const unsigned int index = tail & sqMask_;
+		struct io_uring_sqe &sqe = sqes_[index];
+		std::memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_STATX;
+		sqe.fd = dirfd;
+		sqe.addr = reinterpret_cast<std::uint64_t>(path);
+		sqe.len = STATX_TYPE | STATX_SIZE | STATX_MTIME;
+		sqe.off = reinterpret_cast<std::uint64_t>(buffer);
+		sqe.statx_flags = AT_STATX_SYNC_AS_STAT;
+		sqe.user_data = userData;
+		sqArray_[index] = index;
+		__atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+		++unsubmitted_;
+		countSystemCall(SYSCALL_STAT);
+	}
+	/// ς񂾗v𔭍sAwait̂Ƃ͈ȏ㊮܂ő҂܂B
+	bool submitAndWait(bool wait)
+	{
+		for(;;){
+			countSystemCall(SYSCALL_URING_ENTER);
+			const int result = static_cast<int>(::syscall(__NR_io_uring_enter, fd_, unsubmitted_, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+			if(result >= 0){
+				unsubmitted_ -= static_cast<unsigned int>(result);
+				return true;
+			}
+			if(errno != EINTR){
+				return false;
+			}
+		}
+	}
+	/// vΈotrueԂ܂B
+	bool popCompletion(std::uint64_t &userData, int &result)
+	{
+		const unsigned int head = *cqHead_;
+		if(head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)){
+			return false;
+		}
+		const struct io_uring_cqe &cqe = cqes_[head & cqMask_];
+		userData = cqe.user_data;
+		result = cqe.res;
+		__atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+private:
+	StatxRing(const StatxRing &);
+	StatxRing &operator=(const StatxRing &);
+
+	void release()
+	{
+		if(sqes_ != MAP_FAILED){ ::munmap(sqes_, sqesSize_); sqes_ = static_cast<struct io_uring_sqe *>(MAP_FAILED);}
+		if(cqRing_ != MAP_FAILED){ ::munmap(cqRing_, cqRingSize_); cqRing_ = MAP_FAILED;}
+		if(sqRing_ != MAP_FAILED){ ::munmap(sqRing_, sqRingSize_); sqRing_ = MAP_FAILED;}
+		if(fd_ != -1){ ::close(fd_); fd_ = -1;}
+	}
+};
+
+/**
+ * 񋓎qɑ݂oStatxRing̒ułB
+ *
+ * ċAIȗ񋓂ł͐e̗񋓎qO܂܎q񋓂̂ŁAO͕KvȂĎg񂵂܂B
+ * io_uringgȂƕnullptrԂA񋓎q͑擾܂B
+ */
+class StatxRingPool
+{
+	std::mutex mutex_;
+	std::vector<std::unique_ptr<StatxRing>> rings_;
+	std::atomic<bool> unavailable_;
+public:
+	StatxRingPool() : unavailable_(false) {}
+	static StatxRingPool &getInstance()
+	{
+		static StatxRingPool pool;
+		return pool;
+	}
+	std::unique_ptr<StatxRing> acquire()
+	{
+		if(unavailable_){
+			return std::unique_ptr<StatxRing>();
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if(!rings_.empty()){
+				std::unique_ptr<StatxRing> ring(std::move(rings_.back()));
+				rings_.pop_back();
+				return ring;
+			}
+		}
+		std::unique_ptr<StatxRing> ring(new StatxRing());
+		if(!ring->isValid()){
+			setUnavailable();
+			ring.reset();
+		}
+		return ring;
+	}
+	void release(std::unique_ptr<StatxRing> ring)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		rings_.push_back(std::move(ring));
+	}
+	/// IORING_OP_STATXɑΉĂȂJ[lȂǂŌĂяo܂B
+	void setUnavailable() { unavailable_ = true;}
+	bool isUnavailable() const { return unavailable_;}
+};
+
+const PathChar SEPARATOR = PATH_CHAR_L('/');
+
+
+// --------------------------------------------------------
+// Output File
+// --------------------------------------------------------
+
+class OutputFile
+{
+	int fd_;
+public:
+	OutputFile() : fd_(-1) {}
+	~OutputFile() { close();}
+	bool create(const PathString &p)
+	{
+		countSystemCall(SYSCALL_FILE_OPEN);
+		fd_ = ::open(p.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		return fd_ != -1;
+	}
+	/// uÕt@Coriginal΁Ãp[~bVp܂B
+	void copyPermissionsFrom(const PathString &original)
+	{
+		struct stat st;
+		if(::stat(original.c_str(), &st) == 0){
+			::fchmod(fd_, st.st_mode & 07777);
+		}
+	}
+	bool write(const char *data, std::size_t size)
+	{
+		while(size > 0){
+			countSystemCall(SYSCALL_FILE_WRITE);
+			const ssize_t written = ::write(fd_, data, size);
+			if(written < 0){
+				if(errno == EINTR){
+					continue;
+				}
+				return false;
+			}
+			data += written;
+			size -= written;
+		}
+		return true;
+	}
+	bool sync()
+	{
+		return ::fsync(fd_) == 0;
+	}
+	void close()
+	{
+		if(fd_ != -1){
+			::close(fd_);
+			fd_ = -1;
+		}
+	}
+};
+
+PathString getTemporaryPathFor(const PathString &p)
+{
+	return p + PATH_CHAR_L(".tmp") + std::to_string(::getpid());
+}
+/// pV{bNNȂANǂ̃pXԂ܂(û̓Nł͂Ȃ̐ł)B
+PathString resolveFileLink(const PathString &p)
+{
+	PathString path = p;
+	for(int depth = 0; depth < 40; ++depth){ // same limit as the kernel's ELOOP
+		std::vector<char> buffer(256);
+		ssize_t size;
+		while((size = ::readlink(path.c_str(), buffer.data(), buffer.size())) == static_cast<ssize_t>(buffer.size())){
+			buffer.resize(buffer.size() * 2);
+		}
+		if(size < 0){
+			return path; // not a link (or does not exist yet)
+		}
+		const PathString target(buffer.data(), size);
+		path = target[0] == '/' ? target : getPathNotFileNamePart(path) + target;
+	}
+	return path;
+}
+bool replaceFile(const PathString &src, const PathString &dst)
+{
+	if(::rename(src.c_str(), dst.c_str()) != 0){
+		return false;
+	}
+	// make the rename itself durable
+	const PathString dir = getPathDirectoryPart(dst);
+	const int dirfd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(dirfd != -1){
+		::fsync(dirfd);
+		::close(dirfd);
+	}
+	return true;
+}
+
+}//namespace
+
+
+namespace detfc{
+
+// --------------------------------------------------------
+// File Name
+// --------------------------------------------------------
+
+PathString::size_type getPathFileNamePos(const PathString &s)
+{
+	// /a/b => b
+	// /a/ => (empty)
+	// / => (empty)
+	// a => a
+	// => (empty)
+	const std::size_t lastSep = s.rfind(SEPARATOR);
+	return (lastSep == PathString::npos) ? 0 : lastSep + 1;
+}
+
+PathString::size_type findPathSeparator(const PathString &s, PathString::size_type pos)
+{
+	return s.find(SEPARATOR, pos);
+}
+
+PathString getPathFileNamePart(const PathString &s)
+{
+	return PathString(s, getPathFileNamePos(s));
+}
+
+PathString getPathNotFileNamePart(const PathString &s)
+{
+	return PathString(s, 0, getPathFileNamePos(s));
+}
+
+bool isPathTerminatedByRedundantSeparator(const PathString &s)
+{
+	// a/ => true
+	// /a/ => true
+	// / => false
+	// // => false
+	return s.size() >= 2
+		&& s[s.size() - 1] == SEPARATOR
+		&& s.find_first_not_of(SEPARATOR) != PathString::npos;
+}
+
+PathString getPathWithoutLastRedundantSeparator(const PathString &s)
+{
+	if(isPathTerminatedByRedundantSeparator(s)){
+		return PathString(s, 0, s.size() - 1);
+	}
+	else{
+		return s;
+	}
+}
+
+PathString getPathDirectoryPart(const PathString &s)
+{
+	return getPathWithoutLastRedundantSeparator(getPathNotFileNamePart(s));
+}
+
+PathString concatPath(const PathString &a, const PathString &b)
+{
+	if(a.empty()){
+		return b;
+	}
+	else if(b.empty()){
+		return a;
+	}
+	else if(a[a.size() - 1] == SEPARATOR){
+		return a + b;
+	}
+	else{
+		return a + SEPARATOR + b;
+	}
+}
+
+PathString getPathChildPrefix(const PathString &dir)
+{
+	if(dir.empty() || dir[dir.size() - 1] == SEPARATOR){
+		return dir;
+	}
+	return dir + SEPARATOR;
+}
+
+bool isPathUnderDirectory(const PathString &p, const PathString &dir)
+{
+	// a/b under a => true
+	// a/b under a/ => true
+	// ab under a => false
+	// a under a => false
+	if(dir.empty()){
+		return !p.empty();
+	}
+	const std::size_t prefixLength = (dir[dir.size() - 1] == SEPARATOR) ? dir.size() : dir.size() + 1;
+	return p.size() > prefixLength
+		&& p.compare(0, dir.size(), dir) == 0
+		&& (prefixLength == dir.size() || p[dir.size()] == SEPARATOR);
+}
+
+
+// --------------------------------------------------------
+// File Operation
+// --------------------------------------------------------
+
+FileType getPathFileType(const PathString &p)
+{
+	FileAttributes attrs;
+	if(!queryAttributes(AT_FDCWD, p.c_str(), FILEATTR_TYPE, attrs)){
+		return FILETYPE_ERROR;
+	}
+	return attrs.type;
+}
+
+bool isPathExists(const PathString &p)
+{
+	return getPathFileType(p) != FILETYPE_ERROR;
+}
+bool isPathDirectory(const PathString &p)
+{
+	return getPathFileType(p) == FILETYPE_DIRECTORY;
+}
+bool isPathRegularFile(const PathString &p)
+{
+	return getPathFileType(p) == FILETYPE_REGULAR;
+}
+
+DirectoryEntry getPathDirectoryEntry(const PathString &p, FileAttributeMask wantedAttributes)
+{
+	// Attributes are fetched on first use, so that callers can filter by name first.
+	DirectoryEntry entry(getPathDirectoryPart(p));
+	entry.assignLazy(getPathFileNamePart(p), FILETYPE_ERROR, 0, wantedAttributes, -1);
+	return entry;
+}
+
+FileTime getPathLastWriteTime(const PathString &p)
+{
+	FileAttributes attrs;
+	if(!queryAttributes(AT_FDCWD, p.c_str(), FILEATTR_LAST_WRITE_TIME, attrs)){
+		return 0;
+	}
+	return attrs.lastWriteTime;
+}
+
+FileTime getPathFileSize(const PathString &p)
+{
+	FileAttributes attrs;
+	if(!queryAttributes(AT_FDCWD, p.c_str(), FILEATTR_SIZE, attrs)){
+		return 0;
+	}
+	return attrs.size;
+}
+
+FileTime getCurrentFileTime()
+{
+	struct timespec ts;
+	::clock_gettime(CLOCK_REALTIME, &ts);
+	return posixFileTime(ts);
+}
+
+FileTime getFileTimeTicksPerSecond()
+{
+	return 1000000000u; // ns
+}
+
+double getProcessCPUTime()
+{
+	double seconds = 0;
+	const int whos[] = {RUSAGE_SELF, RUSAGE_CHILDREN};
+	for(const int who : whos){
+		struct rusage usage;
+		if(::getrusage(who, &usage) == 0){
+			seconds += usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+				+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+		}
+	}
+	return seconds;
+}
+
+PathString getCurrentDirectory()
+{
+	std::vector<char> buffer(256);
+	while(::getcwd(buffer.data(), buffer.size()) == nullptr){
+		if(errno != ERANGE){
+			return PathString();
+		}
+		buffer.resize(buffer.size() * 2);
+	}
+	return PathString(buffer.data());
+}
+
+bool setCurrentDirectory(const PathString &p)
+{
+	return ::chdir(p.c_str()) == 0;
+}
+
+bool createDirectory(const PathString &p)
+{
+	return ::mkdir(p.c_str(), 0777) == 0;
+}
+
+bool removeDirectory(const PathString &p)
+{
+	return ::rmdir(p.c_str()) == 0;
+}
+
+bool removeFile(const PathString &p)
+{
+	return ::unlink(p.c_str()) == 0;
+}
+
+bool writeFileDescriptor(int fd, const char *data, std::size_t size)
+{
+	while(size > 0){
+		countSystemCall(SYSCALL_FILE_WRITE);
+		const ssize_t written = ::write(fd, data, size);
+		if(written < 0 && errno == EINTR){
+			continue;
+		}
+		if(written <= 0){
+			return false;
+		}
+		data += written;
+		size -= static_cast<std::size_t>(written);
+	}
+	return true;
+}
+
+
+
+
+// --------------------------------------------------------
+// DirectoryEntryEnumerator
+// --------------------------------------------------------
+
+/**
+ * getdents64ŃfBNgǂݍޗ񋓎qłB
+ *
+ * 傫ȃobt@ňxɑ̃Ggǂݍ݂܂B
+ * Gg̃^Cvd_type狁߁Ȃ͎̑QƂꂽƂɏ߂statxŎ擾܂B
+ * prefetchw肳Ă΁Aobt@ǂݍޖɂꂪI񂾃Ggstatxio_uringł܂Ƃ߂ĔsA
+ * 񋓂Ȃ犮܂(O󂭖ɑ𔭍s܂)B
+ */
+class DirectoryEntryEnumerator::Impl
+{
+	struct LinuxDirent64
+	{
+		std::uint64_t d_ino;
+		std::int64_t d_off;
+		unsigned short d_reclen;
+		unsigned char d_type;
+		char d_name[1];
+	};
+	static const std::size_t BUFFER_SIZE = 64 * 1024;
+
+	/// ɑ擾GgłB
+	struct Prefetch
+	{
+		std::size_t offset; ///< buffer_̒direnẗʒu
+		int result; ///< statx̌(܂łRESULT_PENDING)
+		struct statx stx;
+	};
+	static const int RESULT_PENDING = 1;
+
+	int fd_;
+	FileAttributeMask wantedAttributes_;
+	std::unique_ptr<char[]> buffer_;
+	std::size_t bufferPos_;
+	std::size_t bufferEnd_;
+	DirectoryEntry entry_;
+
+	PrefetchFilter prefetch_;
+	std::unique_ptr<StatxRing> ring_;
+	bool ringBroken_;
+	DirectoryEntry probe_; ///< prefetch_ɓnGg
+	std::vector<Prefetch> prefetches_; ///< buffer_̂ɑ擾Gg(obt@̏)
+	std::size_t nextPrefetch_; ///< ɗ񋓂GǧƂȂprefetches_̓Y
+	std::size_t nextSubmit_; ///< ɔsprefetches_̓Y
+	unsigned int inFlight_; ///< sĉĂȂstatx̐
+public:
+	Impl(const PathString &dir, FileAttributeMask wantedAttributes, const PrefetchFilter &prefetch)
+		: fd_(-1)
+		, wantedAttributes_(wantedAttributes)
+		, buffer_(new char[BUFFER_SIZE])
+		, bufferPos_(0)
+		, bufferEnd_(0)
+		, entry_(dir, PathString(), FILETYPE_ERROR, 0, 0)
+		, prefetch_((wantedAttributes & ~FILEATTR_TYPE) ? prefetch : PrefetchFilter()) // the type alone comes from d_type
+		, ringBroken_(false)
+		, probe_(dir)
+		, nextPrefetch_(0)
+		, nextSubmit_(0)
+		, inFlight_(0)
+	{
+		countSystemCall(SYSCALL_DIRECTORY_OPEN);
+		fd_ = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		makeEntry();
+	}
+	~Impl()
+	{
+		close();
+	}
+	bool isValid() const
+	{
+		return fd_ != -1;
+	}
+	void close()
+	{
+		if(isValid()){
+			finishPrefetches(); // the kernel may still be writing to prefetches_ and reading names from buffer_ with fd_
+			releaseRing();
+			::close(fd_);
+			fd_ = -1;
+		}
+	}
+	void increment()
+	{
+		makeEntry();
+	}
+	const DirectoryEntry &getEntry() const
+	{
+		return entry_;
+	}
+private:
+	const LinuxDirent64 *getDirent(std::size_t offset) const
+	{
+		return reinterpret_cast<const LinuxDirent64 *>(buffer_.get() + offset);
+	}
+	static bool isDotOrDotDot(const char *name)
+	{
+		return std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0;
+	}
+	/// FILETYPE_OTHERɂȂd_typeǂԂ܂B
+	static bool isSpecialFileType(unsigned char type)
+	{
+		return type == DT_FIFO || type == DT_SOCK || type == DT_CHR || type == DT_BLK;
+	}
+	void makeEntry()
+	{
+		while(isValid()){
+			if(bufferPos_ >= bufferEnd_ && !fill()){
+				close();
+				break;
+			}
+			const std::size_t offset = bufferPos_;
+			const LinuxDirent64 *d = getDirent(offset);
+			bufferPos_ += d->d_reclen;
+
+			const char * const name = d->d_name;
+			if(isDotOrDotDot(name)){
+				continue;
+			}
+
+			if(nextPrefetch_ < prefetches_.size() && prefetches_[nextPrefetch_].offset == offset
+				&& loadPrefetched(prefetches_[nextPrefetch_++], name)){
+				return;
+			}
+			switch(d->d_type){
+			case DT_DIR:
+				entry_.assignLazy(name, FILETYPE_DIRECTORY, FILEATTR_TYPE, wantedAttributes_, fd_);
+				break;
+			case DT_REG:
+				entry_.assignLazy(name, FILETYPE_REGULAR, FILEATTR_TYPE, wantedAttributes_, fd_);
+				break;
+			case DT_FIFO:
+			case DT_SOCK:
+			case DT_CHR:
+			case DT_BLK:
+				entry_.assignLazy(name, FILETYPE_OTHER, FILEATTR_TYPE, wantedAttributes_, fd_);
+				break;
+			default:
+				// DT_LNK and DT_UNKNOWN need statx to determine the type.
+				entry_.assignLazy(name, FILETYPE_ERROR, 0, wantedAttributes_, fd_);
+				break;
+			}
+			return;
+		}
+	}
+	bool fill()
+	{
+		finishPrefetches();
+		for(;;){
+			countSystemCall(SYSCALL_DIRECTORY_READ);
+			const long result = ::syscall(SYS_getdents64, fd_, buffer_.get(), BUFFER_SIZE);
+			if(result < 0 && errno == EINTR){
+				continue;
+			}
+			if(result <= 0){
+				return false; // end of directory or error
+			}
+			bufferPos_ = 0;
+			bufferEnd_ = static_cast<std::size_t>(result);
+			if(prefetch_){
+				planPrefetches();
+			}
+			return true;
+		}
+	}
+
+	/// ǂݍ񂾃obt@̂AɎ擾GgIŔs܂B
+	void planPrefetches()
+	{
+		if(!ring_){
+			ring_ = StatxRingPool::getInstance().acquire();
+			if(!ring_){
+				prefetch_ = PrefetchFilter(); // no io_uring; load lazily one by one
+				return;
+			}
+		}
+		for(std::size_t offset = 0; offset < bufferEnd_; ){
+			const LinuxDirent64 *d = getDirent(offset);
+			const std::size_t current = offset;
+			offset += d->d_reclen;
+			if(isDotOrDotDot(d->d_name)){
+				continue;
+			}
+			bool wanted = true; // unknown types need statx anyway
+			if(isSpecialFileType(d->d_type)){
+				wanted = false; // never a target
+			}
+			else if(d->d_type == DT_DIR || d->d_type == DT_REG){
+				probe_.assignLazy(d->d_name, d->d_type == DT_DIR ? FILETYPE_DIRECTORY : FILETYPE_REGULAR, FILEATTR_TYPE, wantedAttributes_, fd_);
+				wanted = prefetch_(probe_);
+			}
+			if(wanted){
+				prefetches_.push_back(Prefetch());
+				prefetches_.back().offset = current;
+				prefetches_.back().result = RESULT_PENDING;
+			}
+		}
+		submitPrefetches();
+	}
+	/// Oȏ󂢂Ă΁A܂sĂȂstatx𔭍s܂B
+	void submitPrefetches()
+	{
+		if(ringBroken_ || nextSubmit_ >= prefetches_.size() || inFlight_ > ring_->getCapacity() / 2){
+			return;
+		}
+		while(nextSubmit_ < prefetches_.size() && inFlight_ < ring_->getCapacity()){
+			Prefetch &prefetch = prefetches_[nextSubmit_];
+			ring_->prepareStatx(fd_, getDirent(prefetch.offset)->d_name, &prefetch.stx, nextSubmit_);
+			++nextSubmit_;
+			++inFlight_;
+		}
+		if(!ring_->submitAndWait(false)){
+			abandonRing();
+		}
+	}
+	/// sstatx̊܂Bwait̂Ƃ͈ȏ܂ő҂܂B
+	void reapPrefetches(bool wait)
+	{
+		for(;;){
+			bool reaped = false;
+			std::uint64_t index;
+			int result;
+			while(ring_->popCompletion(index, result)){
+				prefetches_[static_cast<std::size_t>(index)].result = result;
+				--inFlight_;
+				reaped = true;
+				if(result == -EINVAL){
+					StatxRingPool::getInstance().setUnavailable(); // no IORING_OP_STATX before Linux 5.6
+				}
+			}
+			if(reaped || !wait || inFlight_ == 0){
+				return;
+			}
+			if(ringBroken_ || !ring_->submitAndWait(true)){
+				if(!ringBroken_){
+					abandonRing();
+				}
+				::sched_yield(); // completions of submitted requests still arrive in the mapped ring
+			}
+		}
+	}
+	/// prefetcȟʂentry_ɐݒ肵܂B擾łȂƂfalseԂ܂(QƂꂽƂɉ߂Ď擾܂)B
+	bool loadPrefetched(Prefetch &prefetch, const char *name)
+	{
+		while(prefetch.result == RESULT_PENDING){
+			reapPrefetches(true);
+			submitPrefetches();
+		}
+		reapPrefetches(false);
+		submitPrefetches();
+		if(prefetch.result != 0){
+			return false;
+		}
+		const struct statx &stx = prefetch.stx;
+		entry_.assign(name,
+			(stx.stx_mask & STATX_TYPE) ? posixFileType(stx.stx_mode) : FILETYPE_ERROR,
+			(stx.stx_mask & STATX_SIZE) ? stx.stx_size : 0,
+			(stx.stx_mask & STATX_MTIME) ? posixFileTime(stx.stx_mtime) : 0);
+		return true;
+	}
+	/**
+	 * io_uring_entersƂɌĂяo܂B
+	 * słɃOɎcvƂ܂sĂȂv͒߁Aȍ~͂̃vZXłio_uringg܂B
+	 */
+	void abandonRing()
+	{
+		const std::size_t unsubmitted = ring_->getUnsubmittedCount();
+		for(std::size_t i = nextSubmit_ - unsubmitted; i < prefetches_.size(); ++i){
+			prefetches_[i].result = -EAGAIN;
+		}
+		inFlight_ -= static_cast<unsigned int>(unsubmitted);
+		nextSubmit_ = prefetches_.size();
+		ringBroken_ = true;
+		StatxRingPool::getInstance().setUnavailable();
+	}
+	/// sstatxSĊ̂҂܂(obt@ǂݒOƕOɌĂт܂)B
+	void finishPrefetches()
+	{
+		while(inFlight_ > 0){
+			reapPrefetches(true);
+		}
+		prefetches_.clear();
+		nextPrefetch_ = 0;
+		nextSubmit_ = 0;
+	}
+	void releaseRing()
+	{
+		if(ring_ && !ringBroken_){ // a broken ring still holds unsubmitted requests
+			StatxRingPool::getInstance().release(std::move(ring_));
+		}
+		ring_.reset();
+	}
+};
+
+DirectoryEntryEnumerator::DirectoryEntryEnumerator(const PathString &dir, FileAttributeMask wantedAttributes, const PrefetchFilter &prefetch) : impl_(new Impl(dir, wantedAttributes, prefetch)) {}
+DirectoryEntryEnumerator::~DirectoryEntryEnumerator() {}
+bool DirectoryEntryEnumerator::isEnd() const {return !impl_->isValid();}
+const DirectoryEntry &DirectoryEntryEnumerator::getEntry() const { return impl_->getEntry();}
+void DirectoryEntryEnumerator::increment() {impl_->increment();}
+
+void DirectoryEntry::loadAttributes(FileAttributeMask attrs) const
+{
+	FileAttributes result;
+	const bool succeeded = (dirHandle_ != -1)
+		? queryAttributes(dirHandle_, filename_.c_str(), attrs, result)
+		: queryAttributes(AT_FDCWD, getPath().c_str(), attrs, result);
+	if(!succeeded){
+		type_ = FILETYPE_ERROR;
+		loadedAttributes_ = FILEATTR_ALL; // do not retry
+		return;
+	}
+	if(attrs & FILEATTR_TYPE){ type_ = result.type;}
+	if(attrs & FILEATTR_SIZE){ size_ = result.size;}
+	if(attrs & FILEATTR_LAST_WRITE_TIME){ lastWriteTime_ = result.lastWriteTime;}
+	loadedAttributes_ |= attrs;
+}
+
+
+
+// --------------------------------------------------------
+// MappedFile
+// --------------------------------------------------------
+
+class MappedFile::Impl
+{
+	const char *data_;
+	std::size_t size_;
+public:
+	explicit Impl(const PathString &p)
+		: data_(nullptr)
+		, size_(0)
+	{
+		countSystemCall(SYSCALL_FILE_OPEN);
+		const int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+		if(fd == -1){
+			return;
+		}
+		struct stat st;
+		if(::fstat(fd, &st) == 0 && st.st_size > 0){
+			void * const addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if(addr != MAP_FAILED){
+				data_ = static_cast<const char *>(addr);
+				size_ = st.st_size;
+			}
+		}
+		::close(fd); // the mapping stays valid
+	}
+	~Impl()
+	{
+		if(data_){
+			::munmap(const_cast<char *>(data_), size_);
+		}
+	}
+	bool isValid() const { return data_ != nullptr;}
+	const char *getData() const { return data_;}
+	std::size_t getSize() const { return size_;}
+};
+
+MappedFile::MappedFile() {}
+MappedFile::~MappedFile() {}
+bool MappedFile::open(const PathString &p)
+{
+	impl_.reset(new Impl(p));
+	if(!impl_->isValid()){
+		impl_.reset();
+		return false;
+	}
+	return true;
+}
+void MappedFile::close() { impl_.reset();}
+bool MappedFile::isOpen() const { return impl_ != nullptr;}
+const char *MappedFile::getData() const { return impl_ ? impl_->getData() : nullptr;}
+std::size_t MappedFile::getSize() const { return impl_ ? impl_->getSize() : 0;}
+
+}//namespace detfc
+
+#endif //!defined(WIN32)
+
+
+
+#include <atomic>
+
+// --------------------------------------------------------
+// System Call Counters (common)
+// --------------------------------------------------------
+
+namespace detfc{
+
+namespace {
+std::atomic<std::uint64_t> systemCallCounts[SYSCALL_COUNTER_COUNT]; // zero-initialized (static storage)
+}//namespace
+
+void countSystemCall(SystemCallCounter counter)
+{
+	systemCallCounts[counter].fetch_add(1, std::memory_order_relaxed);
+}
+
+std::uint64_t getSystemCallCount(SystemCallCounter counter)
+{
+	return systemCallCounts[counter].load(std::memory_order_relaxed);
+}
+
+const char *getSystemCallCounterName(SystemCallCounter counter)
+{
+	static const char * const names[SYSCALL_COUNTER_COUNT] = {
+		"directoryOpen",
+		"directoryRead",
+		"stat",
+		"fileOpen",
+		"fileRead",
+		"fileWrite",
+		"uringEnter",
+	};
+	return names[counter];
+}
+
+}//namespace detfc
+
+
+
+// --------------------------------------------------------
+// AtomicFileWriter (common)
+// --------------------------------------------------------
+
+namespace detfc{
+
+class AtomicFileWriter::Impl : public std::streambuf
+{
+	PathString path_;
+	PathString tempPath_;
+	OutputFile file_;
+	std::unique_ptr<char[]> buffer_;
+	std::size_t bufferSize_;
+	bool opened_;
+	bool failed_;
+	bool committed_;
+	std::ostream stream_;
+public:
+	Impl(const PathString &p, std::size_t bufferSize)
+		: path_(resolveFileLink(p))
+		, tempPath_(getTemporaryPathFor(path_))
+		, buffer_(new char[bufferSize])
+		, bufferSize_(bufferSize)
+		, opened_(false)
+		, failed_(false)
+		, committed_(false)
+		, stream_(this)
+	{
+		opened_ = file_.create(tempPath_);
+		if(opened_){
+			file_.copyPermissionsFrom(path_);
+		}
+		setp(buffer_.get(), buffer_.get() + bufferSize_);
+		if(!opened_){
+			stream_.setstate(std::ios::badbit);
+		}
+	}
+	~Impl()
+	{
+		if(opened_ && !committed_){
+			file_.close();
+			removeFile(tempPath_);
+		}
+	}
+	bool isOpen() const { return opened_;}
+	std::ostream &getStream() { return stream_;}
+	bool commit()
+	{
+		if(!opened_ || committed_){
+			return false;
+		}
+		stream_.flush();
+		const bool succeeded = !failed_ && stream_.good() && file_.sync();
+		file_.close();
+		if(!succeeded || !replaceFile(tempPath_, path_)){
+			removeFile(tempPath_);
+			opened_ = false;
+			return false;
+		}
+		committed_ = true;
+		return true;
+	}
+protected:
+	virtual int_type overflow(int_type ch)
+	{
+		if(!flushBuffer()){
+			return traits_type::eof();
+		}
+		if(!traits_type::eq_int_type(ch, traits_type::eof())){
+			*pptr() = traits_type::to_char_type(ch);
+			pbump(1);
+		}
+		return traits_type::not_eof(ch);
+	}
+	virtual std::streamsize xsputn(const char_type *s, std::streamsize n)
+	{
+		if(static_cast<std::size_t>(n) < bufferSize_){
+			return std::streambuf::xsputn(s, n);
+		}
+		// large blocks bypass the buffer
+		if(!flushBuffer() || !write(s, static_cast<std::size_t>(n))){
+			return 0;
+		}
+		return n;
+	}
+	virtual int sync()
+	{
+		return flushBuffer() ? 0 : -1;
+	}
+private:
+	bool flushBuffer()
+	{
+		const std::size_t size = pptr() - pbase();
+		setp(buffer_.get(), buffer_.get() + bufferSize_);
+		return write(buffer_.get(), size);
+	}
+	bool write(const char *data, std::size_t size)
+	{
+		if(failed_ || !opened_){
+			return false;
+		}
+		if(!file_.write(data, size)){
+			failed_ = true;
+			return false;
+		}
+		return true;
+	}
+};
+
+const std::size_t AtomicFileWriter::DEFAULT_BUFFER_SIZE;
+AtomicFileWriter::AtomicFileWriter(const PathString &p, std::size_t bufferSize) : impl_(new Impl(p, bufferSize)) {}
+AtomicFileWriter::~AtomicFileWriter() {}
+bool AtomicFileWriter::isOpen() const { return impl_->isOpen();}
+std::ostream &AtomicFileWriter::getStream() { return impl_->getStream();}
+bool AtomicFileWriter::commit() { return impl_->commit();}
+
+}//namespace detfc
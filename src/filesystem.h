@@ -3,7 +3,9 @@
 
 #include <string>
 #include <memory>
+#include <functional>
 #include <cstdint>
+#include <ostream>
 
 namespace detfc{
 
@@ -13,12 +15,19 @@ typedef std::string PathString;
 
 // File Name
 
+/// Ō̃t@C̐擪̈ʒuԂ܂B
+PathString::size_type getPathFileNamePos(const PathString &s);
+/// posȍ~ōŏ̃pX؂蕶̈ʒuԂ܂BƂnposԂ܂Bpos͕̋EłȂ΂Ȃ܂B
+PathString::size_type findPathSeparator(const PathString &s, PathString::size_type pos = 0);
 PathString getPathFileNamePart(const PathString &s);
 PathString getPathNotFileNamePart(const PathString &s);
 bool isPathTerminatedByRedundantSeparator(const PathString &s);
 PathString getPathWithoutLastRedundantSeparator(const PathString &s);
 PathString getPathDirectoryPart(const PathString &s);
 PathString concatPath(const PathString &a, const PathString &b);
+/// łȂnameɂāAconcatPath(dir, name) == getPathChildPrefix(dir) + nameƂȂ镶Ԃ܂B
+PathString getPathChildPrefix(const PathString &dir);
+bool isPathUnderDirectory(const PathString &p, const PathString &dir);
 
 // Directory Entry
 
@@ -26,18 +35,40 @@ enum FileType
 {
 	FILETYPE_ERROR,
 	FILETYPE_REGULAR,
-	FILETYPE_DIRECTORY
+	FILETYPE_DIRECTORY,
+	FILETYPE_OTHER ///< FIFOA\PbgAfoCXȂ(`FbNΏۂɂAǂݍ݂܂)
 };
 typedef std::uint64_t FileTime;
 typedef std::uint64_t FileSize;
 
+/**
+ * DirectoryEntry̑̂A擾KvȂ̂\rbgłB
+ */
+enum FileAttribute
+{
+	FILEATTR_TYPE = 1,
+	FILEATTR_SIZE = 2,
+	FILEATTR_LAST_WRITE_TIME = 4,
+	FILEATTR_ALL = FILEATTR_TYPE | FILEATTR_SIZE | FILEATTR_LAST_WRITE_TIME
+};
+typedef unsigned int FileAttributeMask;
+
+/**
+ * fBNgGgłB
+ *
+ * ͕KvɂȂƂɏ߂Ď擾邱Ƃ܂B
+ * 擾Ƃ́AQƂꂽɉwantedAttributesɎw肳ꂽ܂Ƃ߂Ď擾܂B
+ */
 class DirectoryEntry
 {
 	PathString dir_;
 	PathString filename_;
-	FileType type_;
-	FileSize size_;
-	FileTime lastWriteTime_;
+	mutable FileType type_;
+	mutable FileSize size_;
+	mutable FileTime lastWriteTime_;
+	mutable FileAttributeMask loadedAttributes_;
+	FileAttributeMask wantedAttributes_;
+	int dirHandle_; ///< x擾Ƃ̊fBNg(-1̂Ƃ̓pXŎ擾)
 public:
 	DirectoryEntry(
 		const PathString &dir = PathString(),
@@ -45,14 +76,31 @@ public:
 		FileType type = FILETYPE_ERROR,
 		FileSize size = 0,
 		FileTime lastWriteTime = 0)
-		: dir_(dir), filename_(filename), type_(type), size_(size), lastWriteTime_(lastWriteTime){}
+		: dir_(dir), filename_(filename), type_(type), size_(size), lastWriteTime_(lastWriteTime)
+		, loadedAttributes_(FILEATTR_ALL), wantedAttributes_(FILEATTR_ALL), dirHandle_(-1){}
+	DirectoryEntry(const DirectoryEntry &rhs)
+		: dir_(rhs.dir_), filename_(rhs.filename_), type_(rhs.type_), size_(rhs.size_), lastWriteTime_(rhs.lastWriteTime_)
+		, loadedAttributes_(rhs.loadedAttributes_), wantedAttributes_(rhs.wantedAttributes_), dirHandle_(-1){} // the handle belongs to the enumerator
+	DirectoryEntry &operator=(const DirectoryEntry &rhs)
+	{
+		dir_ = rhs.dir_;
+		filename_ = rhs.filename_;
+		type_ = rhs.type_;
+		size_ = rhs.size_;
+		lastWriteTime_ = rhs.lastWriteTime_;
+		loadedAttributes_ = rhs.loadedAttributes_;
+		wantedAttributes_ = rhs.wantedAttributes_;
+		dirHandle_ = -1;
+		return *this;
+	}
 	PathString getPath() const { return concatPath(dir_, filename_);}
-	PathString getFilename() const { return filename_;}
-	FileTime getLastWriteTime() const { return lastWriteTime_;}
-	FileSize getFileSize() const { return size_;}
-	FileType getFileType() const { return type_;}
-	bool isDirectory() const { return type_ == FILETYPE_DIRECTORY;}
-	bool isRegularFile() const { return type_ == FILETYPE_REGULAR;}
+	const PathString &getFilename() const { return filename_;}
+	const PathString &getDirectory() const { return dir_;}
+	FileTime getLastWriteTime() const { load(FILEATTR_LAST_WRITE_TIME); return lastWriteTime_;}
+	FileSize getFileSize() const { load(FILEATTR_SIZE); return size_;}
+	FileType getFileType() const { load(FILEATTR_TYPE); return type_;}
+	bool isDirectory() const { return getFileType() == FILETYPE_DIRECTORY;}
+	bool isRegularFile() const { return getFileType() == FILETYPE_REGULAR;}
 
 	void assign(const PathString &filename, FileType type, FileSize size, FileTime lastWriteTime)
 	{
@@ -60,15 +108,52 @@ public:
 		type_ = type;
 		size_ = size;
 		lastWriteTime_ = lastWriteTime;
+		loadedAttributes_ = FILEATTR_ALL;
+		dirHandle_ = -1;
+	}
+	/**
+	 * t@C(Ă)^Cvݒ肵܂B
+	 * c͍̑ŏɎQƂꂽƂdirHandlȇ΃pXŎ擾܂B
+	 */
+	void assignLazy(const PathString &filename, FileType type, FileAttributeMask loadedAttributes, FileAttributeMask wantedAttributes, int dirHandle)
+	{
+		filename_ = filename;
+		type_ = type;
+		size_ = 0;
+		lastWriteTime_ = 0;
+		loadedAttributes_ = loadedAttributes;
+		wantedAttributes_ = wantedAttributes;
+		dirHandle_ = dirHandle;
+	}
+	void loadWantedAttributes() const { load(wantedAttributes_);}
+private:
+	void load(FileAttributeMask attrs) const
+	{
+		if((loadedAttributes_ & attrs) != attrs){
+			loadAttributes(attrs | (wantedAttributes_ & ~loadedAttributes_));
+		}
 	}
+	void loadAttributes(FileAttributeMask attrs) const;
 };
 
+/**
+ * 񋓎q܂Ƃ߂ĐɎ擾ĂGgIԊ֐łB
+ * ^CvĂGgɂČĂ΂܂(^CvȂGg͏ɐɎ擾܂)B
+ */
+typedef std::function<bool(const DirectoryEntry &entry)> PrefetchFilter;
+
+/**
+ * fBNg̒̃Gg񋓂܂B
+ *
+ * prefetchw肷ƁALinuxł͂ꂪtrueԂGg̑io_uringstatxł܂Ƃ߂ėvA
+ * 񋓂i߂Ȃ猋ʂ󂯎܂Bio_uringgȂƂ́A܂ŒʂQƂꂽƂɈ擾܂B
+ */
 class DirectoryEntryEnumerator
 {
 	class Impl;
 	std::shared_ptr<Impl> impl_;
 public:
-	DirectoryEntryEnumerator(const PathString &dir);
+	explicit DirectoryEntryEnumerator(const PathString &dir, FileAttributeMask wantedAttributes = FILEATTR_ALL, const PrefetchFilter &prefetch = PrefetchFilter());
 	~DirectoryEntryEnumerator();
 	const DirectoryEntry &getEntry() const;
 	void increment();
@@ -82,9 +167,86 @@ FileType getPathFileType(const PathString &p);
 bool isPathExists(const PathString &p);
 bool isPathDirectory(const PathString &p);
 bool isPathRegularFile(const PathString &p);
-DirectoryEntry getPathDirectoryEntry(const PathString &p);
+DirectoryEntry getPathDirectoryEntry(const PathString &p, FileAttributeMask wantedAttributes = FILEATTR_ALL);
 FileTime getPathLastWriteTime(const PathString &p);
 FileTime getPathFileSize(const PathString &p);
+/// ݎFileTimeƓEPʂŕԂ܂B
+FileTime getCurrentFileTime();
+/// FileTime1b̒lłB
+FileTime getFileTimeTicksPerSecond();
+/// ̃vZXgCPU([U[ƃJ[l̍v)bŕԂ܂BPOSIXł͏I҂qvZX̕܂݂܂B
+double getProcessCPUTime();
+PathString getCurrentDirectory();
+bool setCurrentDirectory(const PathString &p);
+bool createDirectory(const PathString &p);
+bool removeDirectory(const PathString &p);
+bool removeFile(const PathString &p);
+/// JĂt@CLqqfdsizeoCgSĂ݂܂B
+bool writeFileDescriptor(int fd, const char *data, std::size_t size);
+
+
+// Memory Mapped File
+
+/**
+ * ǂݍݐpŃɃ}bvt@CłB
+ */
+class MappedFile
+{
+	class Impl;
+	std::shared_ptr<Impl> impl_;
+public:
+	MappedFile();
+	~MappedFile();
+	bool open(const PathString &p);
+	void close();
+	bool isOpen() const;
+	const char *getData() const;
+	std::size_t getSize() const;
+};
+
+// System Call Counters
+
+/**
+ * detfct@CVXeɑ΂ĒڔsĂяo̎ނł(\̌vp)B
+ * WCũXg[gƂł́AXg[J񐔂(t@CẽnbVvZł)ǂݍ݂̉񐔂𐔂܂B
+ */
+enum SystemCallCounter
+{
+	SYSCALL_DIRECTORY_OPEN,
+	SYSCALL_DIRECTORY_READ,
+	SYSCALL_STAT,
+	SYSCALL_FILE_OPEN,
+	SYSCALL_FILE_READ,
+	SYSCALL_FILE_WRITE,
+	SYSCALL_URING_ENTER, ///< statx܂Ƃ߂ĔsEio_uring_enter(statx̂SYSCALL_STATŐ܂)
+	SYSCALL_COUNTER_COUNT
+};
+void countSystemCall(SystemCallCounter counter);
+std::uint64_t getSystemCallCount(SystemCallCounter counter);
+const char *getSystemCallCounterName(SystemCallCounter counter);
+
+
+// Atomic File Output
+
+/**
+ * t@CSɏ邽߂̃C^łB
+ *
+ * fBNg̈ꎞt@C֑傫ȃobt@ʂď݁A
+ * commit()ŃfBXN֓Ă猳̃t@Cƒu܂B
+ * commit()ɔjꍇ͈ꎞt@C폜Ãt@Cɂ͐G܂B
+ */
+class AtomicFileWriter
+{
+	class Impl;
+	std::shared_ptr<Impl> impl_;
+public:
+	static const std::size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+	explicit AtomicFileWriter(const PathString &p, std::size_t bufferSize = DEFAULT_BUFFER_SIZE);
+	~AtomicFileWriter();
+	bool isOpen() const;
+	std::ostream &getStream();
+	bool commit();
+};
 
 
 }//namespace detfc
@@ -0,0 +1,216 @@
+#include <cstdint>
+#include "localsocket.h"
+
+#if !defined(WIN32)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace detfc{
+
+namespace {
+const std::uint32_t MAX_MESSAGE_SIZE = 256 * 1024 * 1024;
+}//namespace
+
+#if !defined(WIN32)
+
+// --------------------------------------------------------
+// LocalSocket (Unix domain socket)
+// --------------------------------------------------------
+
+namespace {
+
+bool makeAddress(const PathString &path, struct sockaddr_un &addr)
+{
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(addr.sun_path)){
+		return false;
+	}
+	std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+	return true;
+}
+
+bool isSocketListened(const struct sockaddr_un &addr)
+{
+	const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd == -1){
+		return true; // cannot tell, so leave the file alone
+	}
+	const bool connected = ::connect(fd, reinterpret_cast<const struct sockaddr *>(&addr), sizeof(addr)) == 0;
+	::close(fd);
+	return connected;
+}
+
+}//namespace
+
+bool LocalSocket::isSupported() { return true;}
+
+bool LocalSocket::connect(const PathString &path)
+{
+	close();
+	struct sockaddr_un addr;
+	if(!makeAddress(path, addr)){
+		return false;
+	}
+	fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd_ == -1){
+		return false;
+	}
+	if(::connect(fd_, reinterpret_cast<const struct sockaddr *>(&addr), sizeof(addr)) != 0){
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool LocalSocket::listen(const PathString &path)
+{
+	close();
+	struct sockaddr_un addr;
+	if(!makeAddress(path, addr)){
+		return false;
+	}
+	fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd_ == -1){
+		return false;
+	}
+	// Remove only a stale socket left by a daemon that is gone, never another kind of file.
+	struct stat st;
+	if(::lstat(path.c_str(), &st) == 0){
+		if(!S_ISSOCK(st.st_mode) || isSocketListened(addr)){
+			close();
+			return false;
+		}
+		::unlink(path.c_str());
+	}
+	// Only the owner may connect.
+	const mode_t oldMask = ::umask(077);
+	const bool bound = ::bind(fd_, reinterpret_cast<const struct sockaddr *>(&addr), sizeof(addr)) == 0;
+	::umask(oldMask);
+	if(!bound || ::listen(fd_, 16) != 0){
+		close();
+		return false;
+	}
+	listeningPath_ = path;
+	return true;
+}
+
+bool LocalSocket::accept(LocalSocket &client)
+{
+	client.close();
+	for(;;){
+		const int fd = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+		if(fd != -1){
+			// Reject peers running as another user even if the socket's mode would let them in.
+			struct ucred cred;
+			socklen_t credSize = sizeof(cred);
+			if(::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credSize) != 0 || cred.uid != ::geteuid()){
+				::close(fd);
+				continue;
+			}
+			client.fd_ = fd;
+			return true;
+		}
+		if(errno != EINTR && errno != ECONNABORTED){
+			return false;
+		}
+	}
+}
+
+void LocalSocket::close()
+{
+	if(fd_ != -1){
+		::close(fd_);
+		fd_ = -1;
+	}
+	if(!listeningPath_.empty()){
+		::unlink(listeningPath_.c_str());
+		listeningPath_.clear();
+	}
+}
+
+bool LocalSocket::sendBytes(const char *data, std::size_t size)
+{
+	while(size > 0){
+		const ssize_t result = ::send(fd_, data, size, MSG_NOSIGNAL);
+		if(result < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return false;
+		}
+		data += result;
+		size -= static_cast<std::size_t>(result);
+	}
+	return true;
+}
+
+bool LocalSocket::receiveBytes(char *data, std::size_t size)
+{
+	while(size > 0){
+		const ssize_t result = ::recv(fd_, data, size, 0);
+		if(result < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return false;
+		}
+		if(result == 0){
+			return false; // closed
+		}
+		data += result;
+		size -= static_cast<std::size_t>(result);
+	}
+	return true;
+}
+
+#else
+
+// --------------------------------------------------------
+// LocalSocket (not supported)
+// --------------------------------------------------------
+
+bool LocalSocket::isSupported() { return false;}
+bool LocalSocket::connect(const PathString &) { return false;}
+bool LocalSocket::listen(const PathString &) { return false;}
+bool LocalSocket::accept(LocalSocket &) { return false;}
+void LocalSocket::close() {}
+bool LocalSocket::sendBytes(const char *, std::size_t) { return false;}
+bool LocalSocket::receiveBytes(char *, std::size_t) { return false;}
+
+#endif
+
+
+LocalSocket::LocalSocket() : fd_(-1) {}
+LocalSocket::~LocalSocket() { close();}
+
+bool LocalSocket::sendMessage(const std::string &message)
+{
+	if(!isOpen() || message.size() > MAX_MESSAGE_SIZE){
+		return false;
+	}
+	const std::uint32_t size = static_cast<std::uint32_t>(message.size());
+	return sendBytes(reinterpret_cast<const char *>(&size), sizeof(size))
+		&& sendBytes(message.data(), message.size());
+}
+
+bool LocalSocket::receiveMessage(std::string &message)
+{
+	if(!isOpen()){
+		return false;
+	}
+	std::uint32_t size;
+	if(!receiveBytes(reinterpret_cast<char *>(&size), sizeof(size)) || size > MAX_MESSAGE_SIZE){
+		return false;
+	}
+	message.resize(size);
+	return size == 0 || receiveBytes(&message[0], size);
+}
+
+}//namespace detfc
@@ -0,0 +1,49 @@
+#ifndef DETFC_LOCALSOCKET_H_INCLUDED
+#define DETFC_LOCALSOCKET_H_INCLUDED
+
+#include <string>
+#include "filesystem.h"
+
+namespace detfc{
+
+/**
+ * }ṼvZXԂŒʐM邽߂̃\PbgłB
+ *
+ * POSIXłUnixhC\Pbgg܂BWindowsɂ͑ΉĂ܂(isSupported()falseԂ܂)B
+ * bZ[W͒(32rbg)̌ɓeׂ`őM܂B
+ */
+class LocalSocket
+{
+	int fd_;
+	PathString listeningPath_;
+public:
+	LocalSocket();
+	~LocalSocket();
+
+	static bool isSupported();
+
+	bool isOpen() const { return fd_ != -1;}
+	bool connect(const PathString &path);
+	/**
+	 * pathŐڑ҂󂯂܂B\Pbgt@C͏L҂ڑłp[~bVō܂B
+	 * pathɊɃt@CƂ́A҂󂯂ĂvZX̂ȂÂ\Pbgt@CȂ폜A
+	 * łȂ(̃f[҂󂯂Ă邩A\PbgȊÕt@CȂ)falseԂ܂B
+	 */
+	bool listen(const PathString &path);
+	/// ڑ󂯕t܂BƈقȂ郆[U[̃vZX̐ڑ͕Ď҂܂B
+	bool accept(LocalSocket &client);
+	void close();
+
+	bool sendMessage(const std::string &message);
+	/// bZ[WM܂B肪ڑƂfalseԂ܂B
+	bool receiveMessage(std::string &message);
+
+private:
+	LocalSocket(const LocalSocket &);
+	LocalSocket &operator=(const LocalSocket &);
+	bool sendBytes(const char *data, std::size_t size);
+	bool receiveBytes(char *data, std::size_t size);
+};
+
+}//namespace detfc
+#endif
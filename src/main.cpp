@@ -7,19 +7,46 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <set>
 #include <string>
 #include <fstream>
+#include <sstream>
 #include <cstdlib>
 #include <cassert>
 #include <cctype>
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 
 #include "filesystem.h"
 #include "binaryio.h"
+#include "threadpool.h"
+#include "statdb.h"
+#include "contenthash.h"
+#include "arena.h"
+#include "entrystore.h"
+#include "sharedscan.h"
+#include "pathfilter.h"
+#include "watcher.h"
+#include "localsocket.h"
+#include "childprocess.h"
 
 
 
 namespace detfc {
 
+/**
+ * -onŎw肳ꂽA`FbNΏۂ̈ꕔωƂsR}hłB
+ */
+struct CommandRule
+{
+	PathString pattern; ///< -includeƓ̃p^[
+	PathString command;
+	PathFilter filter; ///< pattern-includeɉ
+};
+
 class CommandLine
 {
 public:
@@ -30,10 +57,30 @@ public:
 	bool ignoreFailureCommand_;
 	bool suppressWriteDB_;
 	bool verbose_;
+	bool watch_;
+	bool incremental_;
+	bool trustsDirectoryTime_;
+	bool quickExit_;
+	bool stats_;
+	bool batchesStat_;
+	unsigned int debounceMs_;
+	unsigned int jobs_;
 	PathString dbFile_;
 	PathString commandChanged_;
 	std::string checkingMethod_;
 	std::vector<PathString> targetExtensions_;
+	std::vector<PathString> includePatterns_;
+	std::vector<PathString> excludePatterns_;
+	PathFilter pathFilter_; ///< -ext, -include, -exclude܂Ƃ߂
+	PathString daemonSocket_;
+	PathString connectSocket_;
+	PathString manifestFile_;
+	PathString changesFile_;
+	int changesFd_;
+	bool changesToCommand_;
+	std::string changesFormat_;
+	std::vector<CommandRule> commandRules_;
+	std::vector<std::string> queryArgs_; ///< -connect, -daemon, -manifestȊÖ(f[-manifest̊eWuɓn܂)
 public:
 	CommandLine()
 		: includesDirectoryInTarget_(false)
@@ -42,7 +89,17 @@ public:
 		, ignoreFailureCommand_(false)
 		, suppressWriteDB_(false)
 		, verbose_(false)
+		, watch_(false)
+		, incremental_(false)
+		, trustsDirectoryTime_(false)
+		, quickExit_(false)
+		, stats_(false)
+		, batchesStat_(false)
+		, debounceMs_(100)
+		, jobs_(1)
 		, checkingMethod_()
+		, changesFd_(-1)
+		, changesToCommand_(false)
 	{}
 
 	const std::vector<PathString> &getTargets() const { return targets_;}
@@ -50,32 +107,82 @@ public:
 	bool optIncludesSubEntriesInTarget() const { return includesSubEntriesInTarget_;}
 	bool optWriteDBBeforeCommand() const { return writeDBBeforeCommand_ && !suppressWriteDB_;}
 	bool optWriteDBAfterCommand() const { return !writeDBBeforeCommand_ && !suppressWriteDB_;}
+	bool optWriteDB() const { return !suppressWriteDB_;}
 	bool optIgnoreFailureCommand() const { return ignoreFailureCommand_;}
 	bool optVerbose() const { return verbose_;}
+	bool optWatch() const { return watch_;}
+	bool optIncremental() const { return incremental_ || trustsDirectoryTime_;}
+	bool optTrustDirectoryTime() const { return trustsDirectoryTime_;}
+	bool optQuickExit() const { return quickExit_;}
+	bool optStats() const { return stats_;}
+	bool optBatchStat() const { return batchesStat_;}
+	unsigned int getDebounceTime() const { return debounceMs_;}
+	unsigned int getJobs() const { return jobs_;}
 	PathString getDBFile() const { return dbFile_;}
 	PathString getCommandChanged() const { return commandChanged_;}
+	const std::vector<CommandRule> &getCommandRules() const { return commandRules_;}
 	const std::string &getCheckingMethod() const { return checkingMethod_;}
+	PathString getDaemonSocket() const { return daemonSocket_;}
+	PathString getConnectSocket() const { return connectSocket_;}
+	PathString getManifestFile() const { return manifestFile_;}
+	PathString getChangesFile() const { return changesFile_;}
+	int getChangesFd() const { return changesFd_;}
+	/// -changes, -changesfd, -changesstdin̂ǂꂩw肳ꂽǂԂ܂B
+	bool optChanges() const { return !changesFile_.empty() || changesFd_ >= 0 || changesToCommand_;}
+	bool optChangesToCommand() const { return changesToCommand_;}
+	bool optChangesJSONLines() const { return changesFormat_ == "jsonl";}
+	const std::vector<std::string> &getQueryArgs() const { return queryArgs_;}
+	const PathFilter &getPathFilter() const { return pathFilter_;}
+
+	/// `FbN͈(`FbNΏۂƔ@)rhsƓǂԂ܂B
+	bool hasSameScope(const CommandLine &rhs) const
+	{
+		return targets_ == rhs.targets_
+			&& includesDirectoryInTarget_ == rhs.includesDirectoryInTarget_
+			&& includesSubEntriesInTarget_ == rhs.includesSubEntriesInTarget_
+			&& dbFile_ == rhs.dbFile_
+			&& incremental_ == rhs.incremental_
+			&& trustsDirectoryTime_ == rhs.trustsDirectoryTime_
+			&& checkingMethod_ == rhs.checkingMethod_
+			&& targetExtensions_ == rhs.targetExtensions_
+			&& includePatterns_ == rhs.includePatterns_
+			&& excludePatterns_ == rhs.excludePatterns_;
+	}
 
 	bool matchTargetExtension(const PathString &p) const
 	{
-		if (targetExtensions_.empty()){
-			return true;
-		}
-		for (const PathString &ext : targetExtensions_){
-			if (p.size() >= ext.size()){
-				std::size_t count = ext.size();
-				for (PathString::const_iterator a = p.end() - ext.size(), b = ext.begin(); count; --count, ++a, ++b){
-					if (std::toupper(*a) != std::toupper(*b)){
-						break;
-					}
-				}
-				if (count == 0){
-					return true;
-				}
+		return pathFilter_.matchesExtension(p);
+	}
+
+	/// path^[Qbĝ̂A(-r̂Ƃ)^[Qbg̉ɂ邩ǂԂ܂B-excludeɈvfBNg̉͏܂B
+	bool isPathInTargets(const PathString &path) const
+	{
+		for (const PathString &target : targets_){
+			if ((path == target
+				|| (includesSubEntriesInTarget_ && isPathUnderDirectory(path, target)))
+				&& !isPathExcluded(path, target)){
+				return true;
 			}
 		}
 		return false;
 	}
+private:
+	/// targetpath܂ł̂ꂩ-excludeɈv邩ǂԂ܂B
+	bool isPathExcluded(const PathString &path, const PathString &target) const
+	{
+		for (PathString p = path; ; ){
+			// split the same way as getPathDirectoryEntry()
+			const PathString dir = getPathDirectoryPart(p);
+			if (pathFilter_.isExcluded(DirectoryEntry(dir, getPathFileNamePart(p)))){
+				return true;
+			}
+			if (p == target || dir == p || (!isPathUnderDirectory(dir, target) && dir != target)){
+				return false;
+			}
+			p = dir;
+		}
+	}
+public:
 
 	bool parse(int argc, char * const *argv)
 	{
@@ -86,6 +193,32 @@ public:
 			const std::string arg(*argIt);
 
 			if(arg[0] == '-'){
+				if (arg == "-connect"){
+					if (++argIt == argEnd){
+						std::cerr << arg << " <socket path>" << std::endl;
+						return false;
+					}
+					connectSocket_ = *argIt;
+					continue;
+				}
+				else if (arg == "-daemon"){
+					if (++argIt == argEnd){
+						std::cerr << arg << " <socket path>" << std::endl;
+						return false;
+					}
+					daemonSocket_ = *argIt;
+					continue;
+				}
+				else if (arg == "-manifest"){
+					if (++argIt == argEnd){
+						std::cerr << arg << " <manifest filename>" << std::endl;
+						return false;
+					}
+					manifestFile_ = *argIt;
+					continue;
+				}
+				queryArgs_.push_back(arg);
+
 				if(arg == "-r"){
 					includesSubEntriesInTarget_ = true;
 				}
@@ -104,11 +237,41 @@ public:
 				else if (arg == "-v"){
 					verbose_ = true;
 				}
+				else if (arg == "-watch"){
+					watch_ = true;
+				}
+				else if (arg == "-incremental"){
+					incremental_ = true;
+				}
+				else if (arg == "-trustdirmtime"){
+					trustsDirectoryTime_ = true;
+				}
+				else if (arg == "-quickexit"){
+					quickExit_ = true;
+				}
+				else if (arg == "-stats"){
+					stats_ = true;
+				}
+				else if (arg == "-uring"){
+					batchesStat_ = true;
+				}
+				else if (arg == "-changesstdin"){
+					changesToCommand_ = true;
+				}
+				else if (arg == "-debounce"){
+					if (++argIt == argEnd){
+						std::cerr << arg << " <milliseconds>" << std::endl;
+						return false;
+					}
+					queryArgs_.push_back(*argIt);
+					debounceMs_ = std::strtoul(*argIt, nullptr, 10);
+				}
 				else if (arg == "-db"){
 					if(++argIt == argEnd){
 						std::cerr << arg << " <DB filename>" << std::endl;
 						return false;
 					}
+					queryArgs_.push_back(*argIt);
 					dbFile_ = *argIt;
 				}
 				else if(arg == "-e"){
@@ -116,21 +279,92 @@ public:
 						std::cerr << arg << " <command>" << std::endl;
 						return false;
 					}
+					queryArgs_.push_back(*argIt);
 					commandChanged_ = *argIt;
 				}
+				else if(arg == "-on"){
+					if(argIt + 1 == argEnd || argIt + 2 == argEnd){
+						std::cerr << arg << " <glob pattern> <command>" << std::endl;
+						return false;
+					}
+					CommandRule rule;
+					rule.pattern = *++argIt;
+					rule.command = *++argIt;
+					rule.filter.addInclude(rule.pattern);
+					queryArgs_.push_back(rule.pattern);
+					queryArgs_.push_back(rule.command);
+					commandRules_.push_back(rule);
+				}
 				else if(arg == "-m"){
 					if (++argIt == argEnd){
-						std::cerr << arg << " <checking method name(0-2)>" << std::endl;
+						std::cerr << arg << " <checking method name(0-4)>" << std::endl;
 						return false;
 					}
+					queryArgs_.push_back(*argIt);
 					checkingMethod_ = *argIt;
 				}
+				else if (arg == "-j"){
+					if (++argIt == argEnd){
+						std::cerr << arg << " <number of threads>" << std::endl;
+						return false;
+					}
+					queryArgs_.push_back(*argIt);
+					jobs_ = std::strtoul(*argIt, nullptr, 10);
+					if (jobs_ == 0){
+						jobs_ = std::max(1u, std::thread::hardware_concurrency());
+					}
+				}
 				else if (arg == "-ext"){
 					if (++argIt == argEnd){
 						std::cerr << arg << " <target extension>" << std::endl;
 						return false;
 					}
+					queryArgs_.push_back(*argIt);
 					targetExtensions_.push_back(*argIt);
+					pathFilter_.addExtension(*argIt);
+				}
+				else if (arg == "-changes"){
+					if (++argIt == argEnd){
+						std::cerr << arg << " <change set filename>" << std::endl;
+						return false;
+					}
+					queryArgs_.push_back(*argIt);
+					changesFile_ = *argIt;
+				}
+				else if (arg == "-changesfd"){
+					if (++argIt == argEnd){
+						std::cerr << arg << " <file descriptor>" << std::endl;
+						return false;
+					}
+					queryArgs_.push_back(*argIt);
+					changesFd_ = static_cast<int>(std::strtol(*argIt, nullptr, 10));
+				}
+				else if (arg == "-changesformat"){
+					if (++argIt == argEnd){
+						std::cerr << arg << " <nul|jsonl>" << std::endl;
+						return false;
+					}
+					queryArgs_.push_back(*argIt);
+					changesFormat_ = *argIt;
+					if (changesFormat_ != "nul" && changesFormat_ != "jsonl"){
+						std::cerr << "Unknown change set format: " << changesFormat_ << std::endl;
+						return false;
+					}
+				}
+				else if (arg == "-include" || arg == "-exclude"){
+					if (++argIt == argEnd){
+						std::cerr << arg << " <glob pattern>" << std::endl;
+						return false;
+					}
+					queryArgs_.push_back(*argIt);
+					if (arg == "-include"){
+						includePatterns_.push_back(*argIt);
+						pathFilter_.addInclude(*argIt);
+					}
+					else{
+						excludePatterns_.push_back(*argIt);
+						pathFilter_.addExclude(*argIt);
+					}
 				}
 				else{
 					std::cerr << "Unknown option: " << arg << std::endl;
@@ -139,42 +373,547 @@ public:
 			}
 			else{
 				targets_.push_back(arg);
+				queryArgs_.push_back(arg);
 			}
 		}
 
+		if (!daemonSocket_.empty()){
+			return true; // targets and DB come with each query
+		}
+		if (!connectSocket_.empty() && watch_){
+			std::cerr << "-connect cannot be used with -watch." << std::endl;
+			return false;
+		}
+		if (!connectSocket_.empty() && optChanges()){
+			std::cerr << "-changes, -changesfd and -changesstdin cannot be used with -connect." << std::endl;
+			return false;
+		}
+		if (!manifestFile_.empty()){
+			if (watch_ || !connectSocket_.empty()){
+				std::cerr << "-manifest cannot be used with -watch or -connect." << std::endl;
+				return false;
+			}
+			return true; // each job has its own DB
+		}
 		if(dbFile_.empty()){
 			std::cerr << "-db <DB filename>w肵ĂB" << std::endl;
 			return false;
 		}
+		if (changesToCommand_ && commandChanged_.empty() && commandRules_.empty()){
+			std::cerr << "-changesstdin requires -e or -on." << std::endl;
+			return false;
+		}
+		return true;
+	}
+};
+
+
+/**
+ * sJSON̒̕gƂăGXP[vAoutɒǉ܂(Öp͕t܂)B
+ */
+static void appendJSONString(std::string &out, const std::string &s)
+{
+	static const char hexDigits[] = "0123456789abcdef";
+	for(const char c : s){
+		if(c == '"' || c == '\\'){
+			out += '\\';
+			out += c;
+		}
+		else if(static_cast<unsigned char>(c) < 0x20){
+			out += "\\u00";
+			out += hexDigits[(c >> 4) & 0xf];
+			out += hexDigits[c & 0xf];
+		}
+		else{
+			out += c;
+		}
+	}
+}
+
+
+/**
+ * -statsŏo͂Ã`FbN̒iK̎ԂƃJE^łB
+ */
+class RunStats
+{
+public:
+	enum Phase
+	{
+		PHASE_READ_DB,
+		PHASE_CHECK,
+		PHASE_COMPARE, ///< PHASE_CHECK̂ǍDBƔrĂ镔(ĂASŶ)
+		PHASE_WRITE_DB,
+		PHASE_COMMAND,
+		PHASE_COUNT
+	};
+	enum Change
+	{
+		CHANGE_ADD,
+		CHANGE_MODIFY,
+		CHANGE_DELETE,
+		CHANGE_COUNT
+	};
+
+	/**
+	 * ĂԂ̌oߎԂCPUԂphaseɉ܂Bstatsnullptr̂Ƃ͉܂B
+	 */
+	class PhaseTimer
+	{
+		RunStats *stats_;
+		Phase phase_;
+		std::chrono::steady_clock::time_point startTime_;
+		double startCPUTime_;
+	public:
+		PhaseTimer(RunStats *stats, Phase phase)
+			: stats_(stats), phase_(phase)
+			, startTime_(stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point())
+			, startCPUTime_(stats ? getProcessCPUTime() : 0)
+		{}
+		~PhaseTimer()
+		{
+			if(stats_){
+				stats_->wallTimes_[phase_] += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime_).count();
+				stats_->cpuTimes_[phase_] += getProcessCPUTime() - startCPUTime_;
+			}
+		}
+	};
+
+	/// 쐬_̎ԂƃJE^L^܂BǂݍޑOdbFilȇ傫́AJE^Ɋ܂߂Ȃ悤ɂŎ擾܂B
+	explicit RunStats(const PathString &dbFile)
+		: dbFile_(dbFile)
+		, dbFileSize_(getPathFileSize(dbFile))
+		, dbWritten_(false)
+		, startTime_(std::chrono::steady_clock::now())
+		, startCPUTime_(getProcessCPUTime())
+		, entryCount_(0)
+		, filteredEntryCount_(0)
+	{
+		for(int i = 0; i < PHASE_COUNT; ++i){
+			wallTimes_[i] = cpuTimes_[i] = 0;
+		}
+		for(int i = 0; i < CHANGE_COUNT; ++i){
+			changeCounts_[i] = 0;
+		}
+		for(int i = 0; i < SYSCALL_COUNTER_COUNT; ++i){
+			startSystemCalls_[i] = getSystemCallCount(static_cast<SystemCallCounter>(i));
+		}
+	}
+
+	/// ŒׂGg𐔂܂(̃XbhĂяo܂)B
+	void countEntry(bool filteredByExtension)
+	{
+		entryCount_.fetch_add(1, std::memory_order_relaxed);
+		if(filteredByExtension){
+			filteredEntryCount_.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	void countChange(Change change) { ++changeCounts_[change];}
+	void setDBWritten() { dbWritten_ = true;}
+
+	/// 쐬Ă̌ʂsJSONŏo܂B
+	void writeJSON(std::ostream &os, const std::string &method, bool changed) const
+	{
+		static const char * const phaseNames[PHASE_COUNT] = {"readDB", "check", "compare", "writeDB", "command"};
+		const double totalWallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime_).count();
+		const double totalCPUTime = getProcessCPUTime() - startCPUTime_;
+		std::uint64_t systemCalls[SYSCALL_COUNTER_COUNT];
+		for(int i = 0; i < SYSCALL_COUNTER_COUNT; ++i){
+			systemCalls[i] = getSystemCallCount(static_cast<SystemCallCounter>(i)) - startSystemCalls_[i];
+		}
+		const FileSize dbBytesWritten = dbWritten_ ? getPathFileSize(dbFile_) : 0;
+
+		os << "{\"method\": " << quoteJSONString(method) << ", \"changed\": " << (changed ? "true" : "false") << ", \"phases\": {";
+		for(int i = 0; i < PHASE_COUNT; ++i){
+			writePhaseJSON(os << quoteJSONString(phaseNames[i]) << ": ", wallTimes_[i], cpuTimes_[i]) << ", ";
+		}
+		writePhaseJSON(os << "\"total\": ", totalWallTime, totalCPUTime) << "}";
+		os << ", \"counters\": {"
+			<< "\"directoriesOpened\": " << systemCalls[SYSCALL_DIRECTORY_OPEN]
+			<< ", \"entriesSeen\": " << entryCount_.load()
+			<< ", \"statsIssued\": " << systemCalls[SYSCALL_STAT]
+			<< ", \"filteredByExt\": " << filteredEntryCount_.load()
+			<< ", \"dbFileSize\": " << dbFileSize_
+			<< ", \"dbBytesWritten\": " << dbBytesWritten
+			<< ", \"added\": " << changeCounts_[CHANGE_ADD]
+			<< ", \"modified\": " << changeCounts_[CHANGE_MODIFY]
+			<< ", \"deleted\": " << changeCounts_[CHANGE_DELETE]
+			<< "}, \"syscalls\": {";
+		for(int i = 0; i < SYSCALL_COUNTER_COUNT; ++i){
+			const SystemCallCounter counter = static_cast<SystemCallCounter>(i);
+			os << (i ? ", " : "") << quoteJSONString(getSystemCallCounterName(counter)) << ": " << systemCalls[i];
+		}
+		os << "}}" << std::endl;
+	}
+
+private:
+	PathString dbFile_;
+	FileSize dbFileSize_; ///< `FbNODBt@C̑傫(ۂɓǂݍ񂾃oCgƂ͌܂)
+	bool dbWritten_;
+	std::chrono::steady_clock::time_point startTime_;
+	double startCPUTime_;
+	std::uint64_t startSystemCalls_[SYSCALL_COUNTER_COUNT];
+	double wallTimes_[PHASE_COUNT]; ///< b
+	double cpuTimes_[PHASE_COUNT]; ///< b
+	std::atomic<std::uint64_t> entryCount_;
+	std::atomic<std::uint64_t> filteredEntryCount_;
+	std::uint64_t changeCounts_[CHANGE_COUNT];
+
+	RunStats(const RunStats &);
+	RunStats &operator=(const RunStats &);
+
+	static std::string quoteJSONString(const std::string &s)
+	{
+		std::string quoted(1, '"');
+		appendJSONString(quoted, s);
+		return quoted += '"';
+	}
+	static std::ostream &writePhaseJSON(std::ostream &os, double wallTime, double cpuTime)
+	{
+		return os << "{\"wallMs\": " << wallTime * 1000 << ", \"cpuMs\": " << cpuTime * 1000 << "}";
+	}
+};
+
+
+/**
+ * -changes, -changesfd, -changesstdinŏoAω̈ꗗłB
+ *
+ * eASY肵ωadd()ňꌏ󂯎Aobt@ɗ߂Ă܂Ƃ߂ďo܂B
+ * -changes̃t@CAtomicFileWriterŏAfinish()Œu܂(`FbN̓xɍ蒼܂)B
+ * -changesstdin̂Ƃ-ẽR}h̕W͂ɂo܂(setCommand())B
+ * -onƂ́Ae[̃p^[Ɉvωǂׂ܂(setRules())B
+ * NUL؂(ނ̈ꕶA󔒁ApXANUL)A-changesformat jsonl̂ƂJSON LinesłB
+ * XbhZ[tł͂܂(eASY͑̌̔rň̃XbhĂяo܂)B
+ */
+class ChangeSet
+{
+public:
+	enum Format
+	{
+		FORMAT_NUL,
+		FORMAT_JSON_LINES
+	};
+	/// pX̎ނłBTYPE_TOP_LEVEL̓R}hCŒڎw肵t@C܂Ƃ߂̂ŁApX͋łB
+	enum EntryType
+	{
+		TYPE_FILE,
+		TYPE_DIRECTORY,
+		TYPE_TOP_LEVEL
+	};
+	static const std::size_t FLUSH_SIZE = 64 * 1024;
+	static const std::size_t STREAM_FLUSH_SIZE = 4 * 1024; ///< R}hɏnƂ̑傫
+
+	/// filełȂfileɁAłȂfd(̂Ƃ͂ǂɂ)o܂B
+	ChangeSet(const PathString &file, int fd, Format format)
+		: file_(file.empty() ? nullptr : new AtomicFileWriter(file))
+		, fileName_(file)
+		, fd_(fd)
+		, format_(format)
+		, failed_(file_ && !file_->isOpen())
+		, command_(nullptr)
+		, streamsToCommand_(false)
+		, commandFailed_(false)
+		, rules_(nullptr)
+		, keepsRuleRecords_(false)
+		, recordCount_(0)
+	{}
+
+	/**
+	 * command̕W͂ɂo悤ɂ܂B
+	 * streamŝƂ͍ŏ̕ω󂯎_ŃR}hNA`FbNƕsďn܂B
+	 * łȂfinishCommand()܂ŗ߂Ă܂B
+	 */
+	void setCommand(ChildProcess *command, bool streams)
+	{
+		command_ = command;
+		streamsToCommand_ = streams;
+	}
+	bool hasCommand() const { return command_ != nullptr;}
+
+	/// ruleŝǂɈvω𒲂ׂ悤ɂ܂BkeepsRecordŝƂ͈vω[ɗ߂Ă܂B
+	void setRules(const std::vector<CommandRule> &rules, bool keepsRecords)
+	{
+		rules_ = &rules;
+		keepsRuleRecords_ = keepsRecords;
+		ruleStates_.assign(rules.size(), RuleState());
+	}
+	bool isRuleMatched(std::size_t index) const { return ruleStates_[index].matched;}
+	/// (setRules()keepsRecordŝƂ)indexԖڂ̃[Ɉvωɏ]ĕׂ̂Ԃ܂B
+	const std::string &getRuleRecords(std::size_t index) const { return ruleStates_[index].records;}
+	/// add()ω̐Ԃ܂B
+	std::size_t getRecordCount() const { return recordCount_;}
+
+	void add(RunStats::Change change, EntryType type, const PathString &path)
+	{
+		++recordCount_;
+		const std::size_t recordPos = buffer_.size();
+		static const char kindLetters[RunStats::CHANGE_COUNT] = {'A', 'M', 'D'};
+		static const char * const kindNames[RunStats::CHANGE_COUNT] = {"add", "modify", "delete"};
+		static const char * const typeNames[] = {"file", "directory", "toplevel"};
+		if(format_ == FORMAT_NUL){
+			buffer_ += kindLetters[change];
+			buffer_ += ' ';
+			buffer_ += path;
+			buffer_ += '\0';
+		}
+		else{
+			buffer_ += "{\"change\": \"";
+			buffer_ += kindNames[change];
+			buffer_ += "\", \"type\": \"";
+			buffer_ += typeNames[type];
+			buffer_ += "\", \"path\": \"";
+			appendJSONString(buffer_, path);
+			buffer_ += "\"}\n";
+		}
+		if(rules_){
+			routeRecord(type, path, recordPos);
+		}
+		if(buffer_.size() >= FLUSH_SIZE
+			|| (streamsToCommand_ && (buffer_.size() >= STREAM_FLUSH_SIZE || (!command_->isStarted() && !commandFailed_)))){
+			flush();
+		}
+	}
+
+	/// co܂BsƂ̓bZ[W\falseԂ܂B
+	bool finish()
+	{
+		flush();
+		if(file_ && !failed_ && !file_->commit()){
+			failed_ = true;
+		}
+		if(failed_){
+			if(file_){
+				std::cerr << "ω̈ꗗ'" << fileName_ << "'݂̏Ɏs܂B" << std::endl;
+			}
+			else{
+				std::cerr << "ω̈ꗗt@CLqq" << fd_ << "ɏ߂܂łB" << std::endl;
+			}
+		}
+		return !failed_;
+	}
+
+	/**
+	 * (setCommand()̂Ƃ)cR}h̕W͂ɏoĕAR}h̏I҂ďIXe[^XԂ܂B
+	 * ܂NĂȂ΂ŋN܂BNłȂƂ127Ԃ܂B
+	 */
+	int finishCommand()
+	{
+		streamsToCommand_ = true;
+		flush();
+		if(!command_->isStarted() && !startCommand()){
+			return 127;
+		}
+		return command_->wait();
+	}
+
+private:
+	std::unique_ptr<AtomicFileWriter> file_;
+	PathString fileName_;
+	int fd_;
+	Format format_;
+	bool failed_;
+	std::string buffer_;
+	ChildProcess *command_;
+	bool streamsToCommand_;
+	std::string commandBuffer_; ///< streamsToCommand_ɂȂ܂ŃR}hɓnɗ߂Ă
+	bool commandFailed_;
+	struct RuleState
+	{
+		bool matched;
+		std::string records;
+		RuleState() : matched(false) {}
+	};
+	const std::vector<CommandRule> *rules_;
+	bool keepsRuleRecords_;
+	std::vector<RuleState> ruleStates_;
+	std::size_t recordCount_;
+
+	ChangeSet(const ChangeSet &);
+	ChangeSet &operator=(const ChangeSet &);
+
+	void flush()
+	{
+		if(!failed_ && !buffer_.empty() && (file_ || fd_ >= 0)){
+			failed_ = file_
+				? !file_->getStream().write(buffer_.data(), buffer_.size())
+				: !writeFileDescriptor(fd_, buffer_.data(), buffer_.size());
+		}
+		if(command_ && !commandFailed_){
+			commandBuffer_ += buffer_;
+			if(streamsToCommand_ && !commandBuffer_.empty()
+				&& (command_->isStarted() || startCommand())){
+				// a command that stops reading its input is not an error
+				command_->writeInput(commandBuffer_.data(), commandBuffer_.size());
+				commandBuffer_.clear();
+			}
+		}
+		buffer_.clear();
+	}
+	/**
+	 * buffer_recordPosɏωAv郋[ɐU蕪܂B
+	 * TYPE_TOP_LEVEL͂ǂ̃[ɂv̂Ƃ܂B
+	 * fBNǵAꎩgp^[Ɉv邩ÃGg(dirsummarymerkleł͂ꂪω)vƂɈv̂Ƃ܂B
+	 */
+	void routeRecord(EntryType type, const PathString &path, std::size_t recordPos)
+	{
+		const DirectoryEntry entry = type == TYPE_TOP_LEVEL ? DirectoryEntry() : DirectoryEntry(getPathDirectoryPart(path), getPathFileNamePart(path));
+		for(std::size_t i = 0; i < rules_->size(); ++i){
+			const PathFilter &filter = (*rules_)[i].filter;
+			if(type == TYPE_TOP_LEVEL
+				|| filter.classify(entry) == PathFilter::MATCH_SELECTED
+				|| (type == TYPE_DIRECTORY && filter.mayIncludeEntryIn(path))){
+				RuleState &state = ruleStates_[i];
+				state.matched = true;
+				if(keepsRuleRecords_){
+					state.records.append(buffer_, recordPos, std::string::npos);
+				}
+			}
+		}
+	}
+	bool startCommand()
+	{
+		if(commandFailed_){
+			return false;
+		}
+		if(!command_->start(true)){
+			commandFailed_ = true;
+			std::cerr << "R}h'" << command_->getCommand() << "'sł܂łB" << std::endl;
+			return false;
+		}
 		return true;
 	}
 };
 
 
+/**
+ * `FbNΏۂ̔ɎgIvVRpC̒萔ɂ̂łB
+ *
+ * eASY͂Ƃev[gŁACheckingMethodFactory
+ * R}hCɍgݍ킹IŐ܂B
+ */
+template<bool IncludesDirectory, bool IncludesSubEntries, bool HasFilter>
+struct EntryPolicy
+{
+	static const bool INCLUDES_DIRECTORY = IncludesDirectory; ///< -d
+	static const bool INCLUDES_SUB_ENTRIES = IncludesSubEntries; ///< -r
+	static const bool HAS_FILTER = HasFilter; ///< -ext, -include, -excludêǂꂩ
+};
+
 class CheckingMethod
 {
 	bool changed_;
+	bool dbUpdateNeeded_;
 protected:
 	const CommandLine &cmdline_;
-	CheckingMethod(const CommandLine &cmdline)
-		: cmdline_(cmdline)
-		, changed_(false)
+	RunStats *stats_; ///< -statŝƂ̂
+	const SharedScan *sharedScan_; ///< -manifest̂Ƃ̂
+	ChangeSet *changeSet_; ///< -changes, -changesfd̂Ƃ̂
+	const FileAttributeMask requiredAttributes_;
+	PrefetchFilter prefetch_; ///< -urinĝƂA񋓎qɑ܂Ƃ߂Ď擾Gg(isEntryToPrefetch)
+	mutable std::mutex errorOutputMutex_;
+	CheckingMethod(const CommandLine &cmdline, FileAttributeMask requiredAttributes)
+		: changed_(false)
+		, dbUpdateNeeded_(false)
+		, cmdline_(cmdline)
+		, stats_(nullptr)
+		, sharedScan_(nullptr)
+		, changeSet_(nullptr)
+		, requiredAttributes_(requiredAttributes)
 	{}
 	void setChanged(){ changed_ = true; }
 	bool getChanged() const { return changed_; }
+	void resetChanged(){ changed_ = false; dbUpdateNeeded_ = false; }
+	/// ῶĂȂADBɋL^ĂXVƂɌĂяo܂B
+	void setDBUpdateNeeded(){ dbUpdateNeeded_ = true; }
+	void countChange(RunStats::Change change){ if(stats_){ stats_->countChange(change);} }
+	/// ω𐔂A-changeŝƂ͈ꗗɂ܂B
+	void recordChange(RunStats::Change change, ChangeSet::EntryType type, const PathString &path)
+	{
+		countChange(change);
+		if(changeSet_){
+			changeSet_->add(change, type, path);
+		}
+	}
+
+	DirectoryEntry getTargetPathEntry(const PathString &path) const
+	{
+		DirectoryEntry entry;
+		if(sharedScan_ && sharedScan_->findEntry(path, entry)){
+			return entry;
+		}
+		return getPathDirectoryEntry(path, requiredAttributes_);
+	}
+
+	/**
+	 * -urinĝƂɁAPolicyŃ`FbNΏۂɂȂGg̑񋓎qɂ܂Ƃ߂Ď擾܂B
+	 * hNX̃RXgN^ŌĂяoĂB
+	 */
+	template<typename Policy>
+	void enablePrefetch()
+	{
+		if (cmdline_.optBatchStat()){
+			prefetch_ = [this](const DirectoryEntry &entry){ return isEntryToPrefetch<Policy>(entry);};
+		}
+	}
 
+	// The per-entry predicates below take the options from Policy (an EntryPolicy matching cmdline_),
+	// so the walkers instantiated for each combination have no option branches per entry.
+	template<typename Policy>
 	bool isEntryTarget(const DirectoryEntry &entry) const
 	{
+		// Reject by name first so that no statx is issued for files that -ext, -include or -exclude filter out.
+		const PathFilter::Match match = Policy::HAS_FILTER ? cmdline_.getPathFilter().classify(entry) : PathFilter::MATCH_SELECTED;
+		if (match == PathFilter::MATCH_EXCLUDED
+			|| (!Policy::INCLUDES_DIRECTORY && match == PathFilter::MATCH_UNSELECTED)){
+			if (stats_){
+				stats_->countEntry(true);
+			}
+			return false;
+		}
+		if (stats_){
+			// with -d, names are not rejected above and unselected files are filtered below
+			stats_->countEntry(match == PathFilter::MATCH_UNSELECTED && entry.isRegularFile());
+		}
 		if (entry.getFileType() == FILETYPE_ERROR){
+			std::lock_guard<std::mutex> lock(errorOutputMutex_);
 			std::cerr << "t@C'" << entry.getPath() << "'̏擾ł܂łB" << std::endl;
 		}
-		return entry.isDirectory() && cmdline_.optIncludesDirectoryInTarget()
-			|| entry.isRegularFile() && cmdline_.matchTargetExtension(entry.getFilename());
+		return (entry.isDirectory() && Policy::INCLUDES_DIRECTORY)
+			|| (entry.isRegularFile() && match == PathFilter::MATCH_SELECTED);
+	}
+	/// isEntryTarget()trueԂ(QƂ)GgǂAOƃ^CvŕԂ܂B
+	template<typename Policy>
+	bool isEntryToPrefetch(const DirectoryEntry &entry) const
+	{
+		const PathFilter::Match match = Policy::HAS_FILTER ? cmdline_.getPathFilter().classify(entry) : PathFilter::MATCH_SELECTED;
+		return entry.isDirectory()
+			? Policy::INCLUDES_DIRECTORY && match != PathFilter::MATCH_EXCLUDED
+			: match == PathFilter::MATCH_SELECTED;
+	}
+	/// entrỷ𒲂ׂ邩ǂԂ܂B-excludeɈvfBNgׂ̉͒܂B
+	template<typename Policy>
+	bool isEntryToDescend(const DirectoryEntry &entry) const
+	{
+		return Policy::INCLUDES_SUB_ENTRIES && entry.isDirectory()
+			&& !(Policy::HAS_FILTER && cmdline_.getPathFilter().isExcluded(entry));
 	}
 public:
+	bool isDBUpdateNeeded() const { return dbUpdateNeeded_; }
+	/// -statŝƂɁAstatsɎԂJE^L^悤ɂ܂B
+	void setRunStats(RunStats *stats) { stats_ = stats;}
+	/// -manifest̂ƂɁAfBNg񋓂scaňʂg悤ɂ܂B
+	void setSharedScan(const SharedScan *scan) { sharedScan_ = scan;}
+	/// -changes, -changesfd̂ƂɁA肵ωchangeSetɏo悤ɂ܂B
+	void setChangeSet(ChangeSet *changeSet) { changeSet_ = changeSet;}
 	virtual bool check() = 0;
 	virtual void readDB() = 0;
 	virtual void writeDB() = 0;
+
+	/// recheck()ɑΉĂ邩ǂԂ܂BΉĂȂꍇ͐VIuWFNgcheck()ĂB
+	virtual bool canRecheck() const { return false;}
+	/**
+	 * Ď[hŁAÕ`FbNȍ~ɕωpX𒲂גāA߂ĕωǂ𔻒肵܂B
+	 */
+	virtual bool recheck(const std::vector<FileWatcher::Change> &) { return false;}
 };
 
 class CheckingMethodFactory
@@ -194,7 +933,30 @@ public:
 		auto it = getMethodNameMap().find(name);
 		return it == getMethodNameMap().end() ? nullptr : it->second;
 	}
-	template<typename T>
+	/// o^ĂASY̖OAASYɂ(łȂOD悵)Ԃ܂B
+	static std::vector<std::string> getDistinctMethodNames()
+	{
+		std::vector<std::pair<MethodFactoryFun, std::string>> methods;
+		for(const auto &nameFun : getMethodNameMap()){
+			const std::string &name = nameFun.first;
+			const bool descriptive = !name.empty() && !std::isdigit(static_cast<unsigned char>(name[0]));
+			auto it = std::find_if(methods.begin(), methods.end(),
+				[&](const std::pair<MethodFactoryFun, std::string> &m){ return m.first == nameFun.second;});
+			if(it == methods.end()){
+				methods.push_back(std::make_pair(nameFun.second, name));
+			}
+			else if(descriptive){
+				it->second = name;
+			}
+		}
+		std::vector<std::string> names;
+		for(const auto &m : methods){
+			names.push_back(m.second);
+		}
+		return names;
+	}
+	/// ASYTnameœo^܂BƂ̓R}hCɍT<EntryPolicy<...>>Iт܂B
+	template<template<typename Policy> class T>
 	struct Reg
 	{
 		Reg(const char * const name)
@@ -203,7 +965,27 @@ public:
 		}
 		static CheckingMethod *create(const CommandLine &cmdline)
 		{
-			return new T(cmdline);
+			if (cmdline.optIncludesDirectoryInTarget()){
+				return createWithFilter<true>(cmdline);
+			}
+			return createWithFilter<false>(cmdline);
+		}
+	private:
+		template<bool IncludesDirectory>
+		static CheckingMethod *createWithFilter(const CommandLine &cmdline)
+		{
+			if (cmdline.getPathFilter().isEmpty()){
+				return createWithRecursion<IncludesDirectory, false>(cmdline);
+			}
+			return createWithRecursion<IncludesDirectory, true>(cmdline);
+		}
+		template<bool IncludesDirectory, bool HasFilter>
+		static CheckingMethod *createWithRecursion(const CommandLine &cmdline)
+		{
+			if (cmdline.optIncludesSubEntriesInTarget()){
+				return new T<EntryPolicy<IncludesDirectory, true, HasFilter>>(cmdline);
+			}
+			return new T<EntryPolicy<IncludesDirectory, false, HasFilter>>(cmdline);
 		}
 	};
 };
@@ -211,19 +993,31 @@ public:
 /**
  * DBt@CV^[Qbg݂ΕύXꂽƌȂASYłB
  */
+template<typename Policy>
 class CheckingMethod0 : public CheckingMethod
 {
 	FileTime dbTime_;
+	std::atomic<bool> found_;
+	WorkStealingThreadPool *pool_;
 public:
 	CheckingMethod0(const CommandLine &cmdline)
-		: CheckingMethod(cmdline)
+		: CheckingMethod(cmdline, FILEATTR_LAST_WRITE_TIME)
 		, dbTime_(0)
-	{}
+		, found_(false)
+		, pool_(nullptr)
+	{
+		enablePrefetch<Policy>();
+	}
 
 	virtual bool check()
 	{
+		const unsigned int jobs = cmdline_.getJobs();
+		if (jobs > 1 && cmdline_.optIncludesSubEntriesInTarget()){
+			return checkParallel(jobs);
+		}
+
 		for(auto target : cmdline_.getTargets()){
-			if(checkPath(target)){
+			if(checkPath(target, 0)){
 				setChanged();
 				return true;
 			}
@@ -232,31 +1026,59 @@ public:
 	}
 
 private:
-	bool checkPath(const PathString &path)
+	/**
+	 * ̃[J[ŕʁX̃Tuc[𑖍܂B
+	 * ǂꂩ̃[J[VGgfound_𗧂āAc̃^XNSđł؂܂B
+	 */
+	bool checkParallel(unsigned int jobs)
 	{
-		return checkEntry(getPathDirectoryEntry(path));
-	}
-	bool checkEntry(const DirectoryEntry &entry)
-	{
-		if (isEntryTarget(entry)){
-			if (checkTargetEntry(entry)){
-				return true;
+		WorkStealingThreadPool pool(jobs);
+		pool_ = &pool;
+		for(auto target : cmdline_.getTargets()){
+			if(checkPath(target, WorkStealingThreadPool::NO_WORKER)){
+				break;
 			}
 		}
+		pool.wait();
+		pool_ = nullptr;
 
-		if(entry.isDirectory() && cmdline_.optIncludesSubEntriesInTarget()){
-			if(checkDirectorySubEntries(entry.getPath())){
-				return true;
-			}
+		if(found_){
+			setChanged();
+		}
+		return getChanged();
+	}
+	bool checkPath(const PathString &path, unsigned int workerIndex)
+	{
+		return checkEntry(getTargetPathEntry(path), workerIndex);
+	}
+	bool checkEntry(const DirectoryEntry &entry, unsigned int workerIndex)
+	{
+		if (isEntryTarget<Policy>(entry)){
+			if (checkTargetEntry(entry)){
+				return true;
+			}
+		}
+
+		if(isEntryToDescend<Policy>(entry)){
+			if(pool_){
+				const PathString dir = entry.getPath();
+				pool_->submit([this, dir](unsigned int w){ checkDirectorySubEntries(dir, w);}, workerIndex);
+			}
+			else if(checkDirectorySubEntries(entry.getPath(), workerIndex)){
+				return true;
+			}
 		}
 		return false;
 	}
-	bool checkDirectorySubEntries(const PathString &dir)
+	bool checkDirectorySubEntries(const PathString &dir, unsigned int workerIndex)
 	{
-		DirectoryEntryEnumerator etor(dir);
+		if(found_){
+			return true;
+		}
+		SharedScan::Enumerator etor(sharedScan_, dir, requiredAttributes_, prefetch_);
 		for(; !etor.isEnd(); etor.increment()){
 			const DirectoryEntry &entry = etor.getEntry();
-			if(checkEntry(entry)){
+			if(checkEntry(entry, workerIndex) || found_){
 				return true;
 			}
 		}
@@ -265,8 +1087,15 @@ private:
 	bool checkTargetEntry(const DirectoryEntry &entry)
 	{
 		if (entry.getLastWriteTime() > getDBModifiedTime()){
-			if (cmdline_.optVerbose()){
-				std::cout << "change: " << entry.getPath() << std::endl;
+			bool expected = false;
+			if (found_.compare_exchange_strong(expected, true)){ // report only the first one
+				if (pool_){
+					pool_->cancel();
+				}
+				countChange(RunStats::CHANGE_MODIFY);
+				if (cmdline_.optVerbose()){
+					std::cout << "change: " << entry.getPath() << std::endl;
+				}
 			}
 			return true;
 		}
@@ -283,6 +1112,7 @@ public:
 
 	virtual void writeDB()
 	{
+		countSystemCall(SYSCALL_FILE_OPEN);
 		std::ofstream ofs(cmdline_.getDBFile().c_str());
 	}
 private:
@@ -302,6 +1132,7 @@ static CheckingMethodFactory::Reg<CheckingMethod0> reg0_1("fast");
  * SẴ^[Qbg̏XLKv̂ŁACheckingMethod0莞Ԃ܂A萳młB
  * ۑEr񂪏Ȃ̂ŁACheckingMethod2荂EeʂłAsmłB
  */
+template<typename Policy>
 class CheckingMethod1 : public CheckingMethod
 {
 	struct DirSummary
@@ -333,30 +1164,38 @@ class CheckingMethod1 : public CheckingMethod
 			return !operator==(rhs);
 		}
 	};
-	std::vector<std::pair<PathString, DirSummary>> dirs_;
-	std::map<PathString, DirSummary> dirsPrev_;
+	typedef std::pair<const PathSlice, DirSummary> DirMapValue;
+	typedef std::map<PathSlice, DirSummary, std::less<PathSlice>, ArenaAllocator<DirMapValue>> DirMap;
+	MonotonicArena arena_; ///< dirs_dirsPrev_̃pXdirsPrev_̃m[h
+	std::vector<std::pair<PathSlice, DirSummary>> dirs_;
+	DirMap dirsPrev_;
 	DirSummary topLevel_;
 	DirSummary topLevelPrev_;
 public:
 	CheckingMethod1(const CommandLine &cmdline)
-		: CheckingMethod(cmdline)
-	{}
+		: CheckingMethod(cmdline, FILEATTR_SIZE | FILEATTR_LAST_WRITE_TIME)
+		, dirsPrev_(std::less<PathSlice>(), ArenaAllocator<DirMapValue>(arena_))
+	{
+		enablePrefetch<Policy>();
+	}
 
 	bool check()
 	{
 		for (auto target : cmdline_.getTargets()){
-			checkTopLevelEntry(getPathDirectoryEntry(target));
+			checkTopLevelEntry(getTargetPathEntry(target));
 		}
 		if(topLevel_ != topLevelPrev_){
 			setChanged();
+			recordChange(RunStats::CHANGE_MODIFY, ChangeSet::TYPE_TOP_LEVEL, PathString());
 			if (cmdline_.optVerbose()){
 				std::cout << "change: top level target" << std::endl;
 			}
 		}
 		if (!dirsPrev_.empty()){ // found deleted directory
 			setChanged();
-			if (cmdline_.optVerbose()){
-				for (auto dir : dirsPrev_){
+			for (auto dir : dirsPrev_){
+				recordChange(RunStats::CHANGE_DELETE, ChangeSet::TYPE_DIRECTORY, dir.first.str());
+				if (cmdline_.optVerbose()){
 					std::cout << "change(delete directory): " << dir.first << std::endl;
 				}
 			}
@@ -366,14 +1205,14 @@ public:
 private:
 	void checkTopLevelEntry(const DirectoryEntry &entry)
 	{
-		if (isEntryTarget(entry)){
+		if (isEntryTarget<Policy>(entry)){
 			topLevel_.add(entry);
 		}
 		checkEntry(entry);
 	}
 	void checkEntry(const DirectoryEntry &entry)
 	{
-		if (entry.isDirectory() && cmdline_.optIncludesSubEntriesInTarget()){
+		if (isEntryToDescend<Policy>(entry)){
 			checkDirectorySubEntries(entry.getPath());
 		}
 	}
@@ -381,21 +1220,22 @@ private:
 	{
 		DirSummary dirSummary;
 
-		DirectoryEntryEnumerator etor(dir);
+		SharedScan::Enumerator etor(sharedScan_, dir, requiredAttributes_, prefetch_);
 		for (; !etor.isEnd(); etor.increment()){
-			const DirectoryEntry entry = etor.getEntry();
+			const DirectoryEntry &entry = etor.getEntry();
 			checkEntry(entry);
 
-			if (isEntryTarget(entry)){
+			if (isEntryTarget<Policy>(entry)){
 				dirSummary.add(entry);
 			}
 		}
 
-		dirs_.push_back(std::pair<PathString, DirSummary>(dir, dirSummary));
-		auto it = dirsPrev_.find(dir);
+		dirs_.push_back(std::pair<PathSlice, DirSummary>(PathSlice::copy(arena_, dir), dirSummary));
+		auto it = dirsPrev_.find(PathSlice::of(dir));
 		if (it == dirsPrev_.end()){
 			// new directory
 			setChanged();
+			recordChange(RunStats::CHANGE_ADD, ChangeSet::TYPE_DIRECTORY, dir);
 			if (cmdline_.optVerbose()){
 				std::cout << "change(add directory):" << dir << std::endl;
 			}
@@ -403,6 +1243,7 @@ private:
 		else{
 			if (it->second != dirSummary){
 				setChanged();
+				recordChange(RunStats::CHANGE_MODIFY, ChangeSet::TYPE_DIRECTORY, dir);
 				if (cmdline_.optVerbose()){
 					std::cout << "change(change directory): " << dir << std::endl;
 				}
@@ -414,6 +1255,7 @@ public:
 	static const unsigned int DB_MAGIC = 'd'|('f'<<8)|('c'<<16)|('1'<<24);
 	virtual void readDB()
 	{
+		countSystemCall(SYSCALL_FILE_OPEN);
 		std::ifstream ifs(cmdline_.getDBFile().c_str(), std::ios::binary);
 		if(!ifs){
 			return; //cannot open.
@@ -426,14 +1268,16 @@ public:
 		if (!ifs){
 			return;
 		}
-		std::map<PathString, DirSummary> dirs;
+		// Nodes and names of a broken DB stay in arena_ until the end of the run.
+		const ArenaAllocator<DirMapValue> allocator(arena_);
+		DirMap dirs(std::less<PathSlice>(), allocator);
 		for (std::size_t i = 0; i < dirCount; ++i){
-			PathString dirName = readStringBinary(ifs);
+			const PathSlice dirName = readStringBinary(ifs, arena_);
 			DirSummary dirSummary = readDirSummary(ifs);
 			if (!ifs){
 				return;
 			}
-			dirs.insert(std::pair<PathString, DirSummary>(dirName, dirSummary));
+			dirs.insert(DirMapValue(dirName, dirSummary));
 		}
 
 		topLevelPrev_ = topLevel;
@@ -441,7 +1285,7 @@ public:
 	}
 	static DirSummary readDirSummary(std::istream &ifs)
 	{
-		const DirSummary::FileCount totalFileCount = readBinary<DirSummary::FileCount>(ifs);
+		const typename DirSummary::FileCount totalFileCount = readBinary<typename DirSummary::FileCount>(ifs);
 		const FileSize totalFileSize = readBinary<FileSize>(ifs);
 		const FileTime latestFileTime = readBinary<FileTime>(ifs);
 		if (!ifs){
@@ -453,26 +1297,32 @@ public:
 	}
 	virtual void writeDB()
 	{
-		std::ofstream ofs(cmdline_.getDBFile().c_str(), std::ios::binary);
-		if (!ofs){
+		AtomicFileWriter writer(cmdline_.getDBFile());
+		if (!writer.isOpen()){
 			std::cerr << "o̓t@C'" << cmdline_.getDBFile() << "'J܂łB" << std::endl;
 			return;
 		}
+		std::ostream &ofs = writer.getStream();
 		writeBinary(ofs, DB_MAGIC);
 		writeDirSummary(ofs, topLevel_);
 		writeBinary(ofs, dirs_.size());
-		for (auto dirNameSummary : dirs_){
+		for (const auto &dirNameSummary : dirs_){
 			writeStringBinary(ofs, dirNameSummary.first);
 			writeDirSummary(ofs, dirNameSummary.second);
 		}
+		if (!writer.commit()){
+			std::cerr << "o̓t@C'" << cmdline_.getDBFile() << "'݂̏Ɏs܂B" << std::endl;
+		}
 	}
-	static void writeDirSummary(std::ostream &os, DirSummary &s)
+	static void writeDirSummary(std::ostream &os, const DirSummary &s)
 	{
 		writeBinary(os, s.totalFileCount);
 		writeBinary(os, s.totalFileSize);
 		writeBinary(os, s.latestFileTime);
 	}
 };
+template<typename Policy>
+const unsigned int CheckingMethod1<Policy>::DB_MAGIC;
 static CheckingMethodFactory::Reg<CheckingMethod1> reg1_0("1");
 static CheckingMethodFactory::Reg<CheckingMethod1> reg1_1("dirsummary");
 
@@ -480,86 +1330,501 @@ static CheckingMethodFactory::Reg<CheckingMethod1> reg1_1("dirsummary");
 /**
  * Gg[̏(^CvATCYAXV)ωAǉ폜ƂɕωƌȂASYłB
  */
+template<typename Policy>
 class CheckingMethod2 : public CheckingMethod
 {
-	std::vector<DirectoryEntry> targets_;
-	std::map<PathString, DirectoryEntry> targetsPrev_;
+	struct Target
+	{
+		EntryStore::Entry entry; ///< store_(̓[J[store)ɂ
+		std::size_t hashJob; ///< hashPipeline_Ɉ˗ԍB˗ĂȂNO_JOB
+		bool contentHashed; ///< contentHash܂Ă邩(checksContent_̂Ƃ̂)
+		ContentHash contentHash;
+		Target(const EntryStore::Entry &entry, std::size_t hashJob)
+			: entry(entry), hashJob(hashJob), contentHashed(false), contentHash(0) {}
+	};
+	static bool lessTargetPath(const Target &a, const Target &b) { return EntryStore::comparePath(a.entry, b.entry) < 0;}
+	typedef std::pair<PathString, FileTime> ScannedDirectory; ///< (path, last write time)
+	/// ̃[J[̏ԂłB
+	struct Worker
+	{
+		std::vector<Target> targets;
+		std::vector<ScannedDirectory> scannedDirs;
+		EntryStore store;
+		PathString pathBuffer;
+	};
+	const bool checksContent_;
+	std::vector<Target> targets_;
+	EntryStore store_;
+	std::size_t compactedStoreSize_; ///< ŌɋlߒƂstore_̑傫
+	PathString pathBuffer_;
+	std::vector<ScannedDirectory> scannedDirs_; ///< -incremental̂Ƃ̂݁BpX
+	FileStatDB targetsPrev_; ///< r̊(ǂݍDBAŌɏDB)
+	FileTime scanStartTime_;
+	std::vector<std::unique_ptr<Worker>> workers_;
+	unsigned int mainWorker_; ///< n߂Xbh(v[̊O)gworkers_̓Y
+	std::unique_ptr<WorkStealingThreadPool> pool_;
+	std::unique_ptr<ContentHashPipeline> hashPipeline_;
+	std::unique_ptr<ContentHasher> hasher_;
 public:
 	CheckingMethod2(const CommandLine &cmdline)
-		: CheckingMethod(cmdline)
-	{}
+		: CheckingMethod(cmdline, FILEATTR_ALL)
+		, checksContent_(false)
+		, compactedStoreSize_(0)
+		, scanStartTime_(0)
+		, mainWorker_(0)
+	{
+		enablePrefetch<Policy>();
+	}
+protected:
+	CheckingMethod2(const CommandLine &cmdline, bool checksContent)
+		: CheckingMethod(cmdline, FILEATTR_ALL)
+		, checksContent_(checksContent)
+		, compactedStoreSize_(0)
+		, scanStartTime_(0)
+		, mainWorker_(0)
+	{
+		enablePrefetch<Policy>();
+	}
+public:
 
 	bool check()
 	{
+		scanTargets();
+		compareTargets();
+		return getChanged();
+	}
+
+	virtual bool canRecheck() const { return true;}
+	/**
+	 * Ocheck()܂recheck()ŏW߂`FbNΏۂ̂Achanges͈̔͂𒲂גĂA
+	 * ŜDB(Ōɏ񂾂)Ɣr܂B
+	 */
+	virtual bool recheck(const std::vector<FileWatcher::Change> &changes)
+	{
+		resetChanged();
+		rescanTargets(changes);
+		compareTargets();
+		return getChanged();
+	}
+
+private:
+	/**
+	 * SẴ`FbNΏۂW߂targets_ɃpXŊi[܂B
+	 *
+	 * -jw肳Ăꍇ̓fBNg̃^XNXbhv[ŕɏ܂B
+	 * ʂ̓pXɕבւ̂ŁADBt@C-v̏o͂͒sƓɂȂ܂B
+	 *
+	 * erꍇAeǂޕKvt@C͑ȂhashPipeline_ɓA
+	 * ƕsēǂݍ݂ƃnbVvZs܂B̏IɑSĂ̌vZ̊҂܂B
+	 *
+	 * -incremental̂Ƃ́AXVDBƓfBNg͗񋓂DBɂ钼̈ꗗg܂B
+	 *
+	 * pX̕EntryStoreɊi[AfBNg͒̃GgŋL܂B
+	 */
+	void scanTargets()
+	{
+		startScan();
 		for(auto target : cmdline_.getTargets()){
-			checkPath(target);
+			checkEntry(getTargetPathEntry(target), nullptr, mainWorker_);
+		}
+		finishScan(targets_, scannedDirs_, store_);
+		compactedStoreSize_ = store_.getAllocatedSize();
+	}
+	void startScan()
+	{
+		scanStartTime_ = getCurrentFileTime();
+		const unsigned int jobs = cmdline_.getJobs();
+		if (jobs > 1 && cmdline_.optIncludesSubEntriesInTarget()){
+			pool_.reset(new WorkStealingThreadPool(jobs));
+		}
+		if (checksContent_){
+			hashPipeline_.reset(new ContentHashPipeline(jobs));
+		}
+		// The calling thread keeps adding targets while the pool runs, so it gets a slot of its own after the pool's.
+		const unsigned int workerCount = pool_ ? pool_->getThreadCount() + 1 : 1;
+		mainWorker_ = workerCount - 1;
+		workers_.clear();
+		for (unsigned int i = 0; i < workerCount; ++i){
+			workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+		}
+	}
+	/**
+	 * ̊҂AW߂`FbNΏۂƑfBNgpXɕׂtargetsdirsɊi[܂B
+	 * `FbNΏۂ̕storeɈ܂B
+	 */
+	void finishScan(std::vector<Target> &targets, std::vector<ScannedDirectory> &dirs, EntryStore &store)
+	{
+		if (pool_){
+			pool_->wait();
+			pool_.reset();
+		}
+		if (hashPipeline_){
+			hashPipeline_->finish();
 		}
 
-		if(!targetsPrev_.empty()){ //found deleted files
-			setChanged();
-			if (cmdline_.optVerbose()){
-				for (auto deletedTarget : targetsPrev_){
-					std::cout << "change(delete): " << deletedTarget.first << std::endl;
+		std::size_t targetCount = 0;
+		for (const std::unique_ptr<Worker> &worker : workers_){
+			targetCount += worker->targets.size();
+		}
+		targets.reserve(targetCount);
+		for (std::unique_ptr<Worker> &worker : workers_){
+			targets.insert(targets.end(), worker->targets.begin(), worker->targets.end());
+			std::move(worker->scannedDirs.begin(), worker->scannedDirs.end(), std::back_inserter(dirs));
+			store.absorb(worker->store);
+		}
+		workers_.clear();
+		std::stable_sort(targets.begin(), targets.end(), lessTargetPath);
+		std::sort(dirs.begin(), dirs.end());
+	}
+	/**
+	 * changes̊epX(subtreêƂ͂̉)ɂ`FbNΏۂWߒāAtargets_̊Yƒu܂B
+	 */
+	void rescanTargets(const std::vector<FileWatcher::Change> &changes)
+	{
+		std::set<PathString> subtrees;
+		for (const FileWatcher::Change &change : changes){
+			if (change.subtree){
+				subtrees.insert(change.path);
+			}
+		}
+		std::vector<bool> stale(targets_.size(), false);
+		startScan();
+		for (const FileWatcher::Change &change : changes){
+			if (!cmdline_.isPathInTargets(change.path) || isPathInSubtrees(change.path, subtrees)){
+				continue;
+			}
+			markStaleTargets(change, stale);
+
+			const DirectoryEntry entry = getTargetPathEntry(change.path);
+			if (entry.getFileType() == FILETYPE_ERROR){
+				continue; // deleted
+			}
+			if (change.subtree){
+				checkEntry(entry, nullptr, mainWorker_);
+			}
+			else if (isEntryTarget<Policy>(entry)){
+				addTarget(entry, nullptr, mainWorker_);
+			}
+		}
+		std::vector<Target> rescanned;
+		std::vector<ScannedDirectory> rescannedDirs;
+		finishScan(rescanned, rescannedDirs, store_); // kept targets still refer to older blocks of store_
+
+		std::vector<Target> targets;
+		targets.reserve(targets_.size() + rescanned.size());
+		for (std::size_t i = 0; i < targets_.size(); ++i){
+			if (!stale[i]){
+				targets.push_back(std::move(targets_[i]));
+				targets.back().hashJob = ContentHashPipeline::NO_JOB; // the pipeline has been replaced
+			}
+		}
+		const std::size_t keptCount = targets.size();
+		std::move(rescanned.begin(), rescanned.end(), std::back_inserter(targets));
+		std::inplace_merge(targets.begin(), targets.begin() + keptCount, targets.end(), lessTargetPath);
+		targets_.swap(targets);
+		if (store_.getAllocatedSize() > compactedStoreSize_ * 2){
+			compactStore();
+		}
+
+		// Directories that were not scanned again keep their old times.
+		// A stale time only makes the next incremental scan enumerate the directory.
+		std::vector<ScannedDirectory> dirs;
+		for (ScannedDirectory &dir : scannedDirs_){
+			const bool rescannedDir = std::any_of(changes.begin(), changes.end(),
+				[&](const FileWatcher::Change &change){
+					return change.subtree && (dir.first == change.path || isPathUnderDirectory(dir.first, change.path));
+				});
+			if (!rescannedDir){
+				dirs.push_back(std::move(dir));
+			}
+		}
+		std::move(rescannedDirs.begin(), rescannedDirs.end(), std::back_inserter(dirs));
+		std::sort(dirs.begin(), dirs.end());
+		scannedDirs_.swap(dirs);
+	}
+	/// uꂽ`FbNΏۂ̕񂪗܂Ȃ悤ɁAtargets_̕񂾂V̈ɕ܂B
+	void compactStore()
+	{
+		EntryStore store;
+		EntryStore::PrefixMap prefixes;
+		for (Target &target : targets_){
+			target.entry = store.copyEntry(target.entry, prefixes);
+		}
+		store_.swap(store);
+		compactedStoreSize_ = store_.getAllocatedSize();
+	}
+	/// path̐efBNĝꂩsubtreesɊ܂܂邩ǂԂ܂(܂܂Ȃ炻Œג܂)B
+	static bool isPathInSubtrees(const PathString &path, const std::set<PathString> &subtrees)
+	{
+		for (PathString dir = getPathDirectoryPart(path); !dir.empty(); ){
+			if (subtrees.count(dir)){
+				return true;
+			}
+			const PathString parent = getPathDirectoryPart(dir);
+			if (parent == dir){
+				break;
+			}
+			dir = parent;
+		}
+		return false;
+	}
+	void markStaleTargets(const FileWatcher::Change &change, std::vector<bool> &stale)
+	{
+		const auto lessPath = [](const Target &t, const PathString &path){ return EntryStore::comparePath(t.entry, path) < 0;};
+		auto it = std::lower_bound(targets_.begin(), targets_.end(), change.path, lessPath);
+		if (it != targets_.end() && EntryStore::comparePath(it->entry, change.path) == 0){
+			stale[it - targets_.begin()] = true;
+		}
+		if (change.subtree){
+			// Paths under a directory are contiguous only from the child prefix on;
+			// a sibling such as "b.txt" sorts between "b" and "b/c".
+			const PathString prefix = getPathChildPrefix(change.path);
+			for (it = std::lower_bound(it, targets_.end(), prefix, lessPath); it != targets_.end(); ++it){
+				const PathString &path = EntryStore::buildPath(it->entry, pathBuffer_);
+				if (path.compare(0, prefix.size(), prefix) != 0){
+					break;
 				}
+				stale[it - targets_.begin()] = true;
 			}
 		}
-		return getChanged();
 	}
-
-private:
-	void checkPath(const PathString &path)
+	/**
+	 * entry𒲂ׂ܂BdirentrỹfBNg[J[storeɊi[̂ŁA
+	 * nullptr̂Ƃ(R}hCύXʒmŎw肳ꂽpX)entrỹpXŜi[܂B
+	 */
+	void checkEntry(const DirectoryEntry &entry, const EntryStore::DirectoryRef *dir, unsigned int workerIndex)
 	{
-		checkEntry(getPathDirectoryEntry(path));
+		if (isEntryTarget<Policy>(entry)){
+			addTarget(entry, dir, workerIndex);
+		}
+		if (isEntryToDescend<Policy>(entry)){
+			scanDirectory(entry, workerIndex);
+		}
 	}
-	void checkEntry(const DirectoryEntry &entry)
+	void scanDirectory(const DirectoryEntry &entry, unsigned int workerIndex)
 	{
-		if (isEntryTarget(entry)){
-			checkTargetEntry(entry);
+		const PathString dir = entry.getPath();
+		const FileTime dirTime = cmdline_.optIncremental() ? entry.getLastWriteTime() : 0; // before enumerating
+		if (pool_){
+			pool_->submit([this, dir, dirTime](unsigned int w){ checkDirectorySubEntries(dir, dirTime, w);},
+				workerIndex == mainWorker_ ? WorkStealingThreadPool::NO_WORKER : workerIndex);
 		}
-		if (entry.isDirectory() && cmdline_.optIncludesSubEntriesInTarget()){
-			checkDirectorySubEntries(entry.getPath());
+		else{
+			checkDirectorySubEntries(dir, dirTime, workerIndex);
 		}
 	}
-	void checkDirectorySubEntries(const PathString &dir)
+	void addTarget(const DirectoryEntry &entry, const EntryStore::DirectoryRef *dir, unsigned int workerIndex)
 	{
-		DirectoryEntryEnumerator etor(dir);
-		for(; !etor.isEnd(); etor.increment()){
-			checkEntry(etor.getEntry());
+		entry.loadWantedAttributes(); // while the enumerator's directory handle is still usable
+		EntryStore &store = workers_[workerIndex]->store;
+		addTarget(dir
+			? store.makeEntry(*dir, entry)
+			: store.makeEntry(entry.getPath(), entry.getFileType(), entry.getFileSize(), entry.getLastWriteTime()),
+			workerIndex);
+	}
+	void addTarget(const EntryStore::Entry &entry, unsigned int workerIndex)
+	{
+		Worker &worker = *workers_[workerIndex];
+		std::size_t hashJob = ContentHashPipeline::NO_JOB;
+		if (hashPipeline_ && entry.isRegularFile()){
+			const PathString &path = EntryStore::buildPath(entry, worker.pathBuffer);
+			if (needsContentHash(path, entry)){
+				hashJob = hashPipeline_->submit(path);
+			}
+		}
+		worker.targets.push_back(Target(entry, hashJob));
+	}
+	/**
+	 * eǂ܂Ȃ΂ȂȂt@Cǂ𔻒肵܂(compareTargets()̔Ɠł)B
+	 */
+	bool needsContentHash(const PathString &path, const EntryStore::Entry &entry) const
+	{
+		if (!entry.isRegularFile()){
+			return false;
 		}
+		const FileStatDB::Record * const prev = targetsPrev_.find(path);
+		return !prev
+			|| !targetsPrev_.hasContentHash()
+			|| entry.type != targetsPrev_.getRecordFileType(*prev)
+			|| entry.size != prev->fileSize
+			|| entry.lastWriteTime != prev->lastWriteTime;
 	}
-	void checkTargetEntry(const DirectoryEntry &entry)
+	void checkDirectorySubEntries(const PathString &dir, FileTime dirTime, unsigned int workerIndex)
 	{
-		targets_.push_back(entry);
+		Worker &worker = *workers_[workerIndex];
+		const EntryStore::DirectoryRef dirRef = worker.store.internDirectory(dir);
+		if (cmdline_.optIncremental()){
+			// A time this close to the scan may be shared with a later change (coarse timestamps),
+			// so record 0 (never reused) instead.
+			const bool settled = dirTime + 2 * getFileTimeTicksPerSecond() < scanStartTime_;
+			worker.scannedDirs.push_back(ScannedDirectory(dir, settled ? dirTime : 0));
 
-		auto it = targetsPrev_.find(entry.getPath());
-		if(it == targetsPrev_.end()){
-			// new file
-			setChanged();
-			if (cmdline_.optVerbose()){
-				std::cout << "change(add): " << entry.getPath() << std::endl;
+			const FileStatDB::Directory * const prevDir = targetsPrev_.findScannedDirectory(dir);
+			if (prevDir && prevDir->lastWriteTime == dirTime && dirTime != 0){
+				reuseDirectorySubEntries(dirRef, *prevDir, workerIndex);
+				return;
 			}
 		}
-		else{
-			if(entry.getFileType() != it->second.getFileType()
-			|| entry.getLastWriteTime() != it->second.getLastWriteTime()
-			|| entry.getFileSize() != it->second.getFileSize()){
-				// changed
+		SharedScan::Enumerator etor(sharedScan_, dir, requiredAttributes_, prefetch_);
+		for(; !etor.isEnd(); etor.increment()){
+			checkEntry(etor.getEntry(), &dirRef, workerIndex);
+		}
+	}
+	/**
+	 * XVςĂȂfBNg̒̃GgA񋓂DB̈ꗗ狁߂܂B
+	 * t@C̓e̕ύX̓fBNg̍XVςȂ̂ŁAʏ̓t@Cstat܂B
+	 * -trustdirmtimêƂ͂ȗDB̏̂܂܎g܂B
+	 */
+	void reuseDirectorySubEntries(const EntryStore::DirectoryRef &dir, const FileStatDB::Directory &prevDir, unsigned int workerIndex)
+	{
+		Worker &worker = *workers_[workerIndex];
+		for (std::size_t i = 0; i < targetsPrev_.getChildRecordCount(prevDir); ++i){
+			const FileStatDB::Record &record = targetsPrev_.getChildRecord(prevDir, i);
+			const PathString name = targetsPrev_.getRecordFileName(record);
+			if (cmdline_.optTrustDirectoryTime()){
+				addTarget(worker.store.makeEntry(dir, name, targetsPrev_.getRecordFileType(record), record.fileSize, record.lastWriteTime), workerIndex);
+			}
+			else{
+				worker.pathBuffer.assign(dir.data, dir.size);
+				worker.pathBuffer += name;
+				const DirectoryEntry entry = getTargetPathEntry(worker.pathBuffer);
+				if (entry.isRegularFile() || entry.isDirectory()){
+					addTarget(entry, &dir, workerIndex);
+				}
+			}
+		}
+		for (std::size_t i = 0; i < targetsPrev_.getSubdirectoryCount(prevDir); ++i){
+			const DirectoryEntry entry = getTargetPathEntry(targetsPrev_.getDirectoryPath(targetsPrev_.getSubdirectory(prevDir, i)));
+			if (isEntryToDescend<Policy>(entry)){
+				scanDirectory(entry, workerIndex);
+			}
+		}
+	}
+	/**
+	 * pXɕtargets_DB̃R[hx̑œ˂킹āAǉEύXE폜𔻒肵܂B
+	 */
+	void compareTargets()
+	{
+		const RunStats::PhaseTimer timer(stats_, RunStats::PHASE_COMPARE);
+		const std::size_t prevCount = targetsPrev_.getRecordCount();
+		std::size_t prevIndex = 0;
+		for(std::size_t i = 0; i < targets_.size(); ++i){
+			const Target &target = targets_[i];
+			const PathString &path = EntryStore::buildPath(target.entry, pathBuffer_);
+			int order = 1;
+			while(prevIndex < prevCount && (order = targetsPrev_.compareRecordPath(targetsPrev_.getRecord(prevIndex), path)) < 0){
+				reportDeletedTarget(targetsPrev_.getRecord(prevIndex++));
+			}
+			if(order != 0){
+				// new file (order < 0 when the deletions above used up the previous records)
 				setChanged();
+				recordChange(RunStats::CHANGE_ADD, getChangeEntryType(target.entry.type), path);
 				if (cmdline_.optVerbose()){
-					std::cout << "change: " << entry.getPath() << std::endl;
+					std::cout << "change(add): " << path << std::endl;
+				}
+				if (checksContent_ && target.entry.isRegularFile()){
+					hashTargetContent(i);
 				}
 			}
 			else{
-				// may be not changed
+				checkTargetEntry(i, targetsPrev_.getRecord(prevIndex++));
 			}
-			targetsPrev_.erase(it);
+		}
+		while(prevIndex < prevCount){
+			reportDeletedTarget(targetsPrev_.getRecord(prevIndex++));
 		}
 	}
+	void checkTargetEntry(std::size_t targetIndex, const FileStatDB::Record &prev)
+	{
+		Target &target = targets_[targetIndex];
+		const EntryStore::Entry &entry = target.entry;
+		const bool typeOrSizeChanged = entry.type != targetsPrev_.getRecordFileType(prev)
+			|| entry.size != prev.fileSize;
+		bool changed = typeOrSizeChanged || entry.lastWriteTime != prev.lastWriteTime;
+
+		if (checksContent_ && entry.isRegularFile()){
+			const bool prevHashAvailable = targetsPrev_.hasContentHash();
+			if (!changed && prevHashAvailable){
+				target.contentHash = targetsPrev_.getRecordContentHash(prev); // no need to read
+				target.contentHashed = true;
+			}
+			else{
+				hashTargetContent(targetIndex);
+				if (!typeOrSizeChanged && prevHashAvailable
+					&& target.contentHash == targetsPrev_.getRecordContentHash(prev)){
+					changed = false; // only the mtime was touched
+				}
+				if (!changed){
+					setDBUpdateNeeded(); // record the new mtime or hash
+				}
+			}
+		}
+
+		if(changed){
+			setChanged();
+			const PathString &path = EntryStore::buildPath(entry, pathBuffer_);
+			recordChange(RunStats::CHANGE_MODIFY, getChangeEntryType(entry.type), path);
+			if (cmdline_.optVerbose()){
+				std::cout << "change: " << path << std::endl;
+			}
+		}
+		else{
+			// may be not changed
+		}
+	}
+	void hashTargetContent(std::size_t targetIndex)
+	{
+		Target &target = targets_[targetIndex];
+		if (target.hashJob != ContentHashPipeline::NO_JOB){
+			target.contentHashed = hashPipeline_->getResult(target.hashJob, target.contentHash);
+		}
+		else if (target.contentHashed){
+			return; // hashed by the previous check and not changed since then
+		}
+		else{
+			// not queued while scanning (e.g. duplicated targets)
+			if (!hasher_){
+				hasher_.reset(new ContentHasher());
+			}
+			target.contentHashed = hasher_->hashFile(EntryStore::buildPath(target.entry, pathBuffer_), target.contentHash);
+		}
+		if (!target.contentHashed){
+			std::cerr << "t@C'" << EntryStore::buildPath(target.entry, pathBuffer_) << "'̓eǂݍ߂܂łB" << std::endl;
+			target.contentHash = 0;
+		}
+	}
+	void reportDeletedTarget(const FileStatDB::Record &prev)
+	{
+		setChanged();
+		if (cmdline_.optVerbose() || changeSet_){
+			const PathString path = targetsPrev_.getRecordPath(prev);
+			recordChange(RunStats::CHANGE_DELETE, getChangeEntryType(targetsPrev_.getRecordFileType(prev)), path);
+			if (cmdline_.optVerbose()){
+				std::cout << "change(delete): " << path << std::endl;
+			}
+		}
+		else{
+			countChange(RunStats::CHANGE_DELETE);
+		}
+	}
+	static ChangeSet::EntryType getChangeEntryType(FileType type)
+	{
+		return type == FILETYPE_DIRECTORY ? ChangeSet::TYPE_DIRECTORY : ChangeSet::TYPE_FILE;
+	}
 
 public:
-	static const unsigned int DB_MAGIC = 'd'|('f'<<8)|('c'<<16)|('2'<<24);
+	static const unsigned int DB_MAGIC = 'd'|('f'<<8)|('c'<<16)|('2'<<24); ///< old format without index
 	virtual void readDB()
 	{
+		if (targetsPrev_.open(cmdline_.getDBFile())){
+			return;
+		}
+		readOldDB();
+	}
+private:
+	void readOldDB()
+	{
+		countSystemCall(SYSCALL_FILE_OPEN);
 		std::ifstream ifs(cmdline_.getDBFile().c_str(), std::ios::binary);
 		if(!ifs){
 			return; //cannot open.
@@ -572,7 +1837,7 @@ public:
 			return; //failed to read targetCount.
 		}
 
-		std::map<PathString, DirectoryEntry> targets;
+		FileStatDBBuilder builder;
 
 		for(std::size_t i = 0; i < targetCount; ++i){
 			const PathString path = readStringBinary(ifs);
@@ -582,41 +1847,906 @@ public:
 			if(!ifs){
 				return; //failed to read a target information.
 			}
-
-			targets.insert(std::pair<PathString, DirectoryEntry>(path, DirectoryEntry(
-				getPathDirectoryPart(path),
-				getPathFileNamePart(path),
-				fileType, fileSize, lastWriteTime)));
+			builder.add(path, fileType, fileSize, lastWriteTime);
 		}
 
-		targetsPrev_.swap(targets);
+		std::vector<char> image;
+		if(builder.build(image)){
+			targetsPrev_.assign(image);
+		}
 	}
 
+public:
 	virtual void writeDB()
 	{
-		std::ofstream ofs(cmdline_.getDBFile().c_str(), std::ios::binary);
-		if(!ofs){
+		FileStatDBBuilder builder;
+		builder.reserve(targets_.size());
+		builder.setContentHashEnabled(checksContent_);
+		for (const ScannedDirectory &dir : scannedDirs_){
+			builder.addScannedDirectory(dir.first, dir.second);
+		}
+		for(std::size_t i = 0; i < targets_.size(); ++i){
+			const Target &target = targets_[i];
+			const EntryStore::Entry &entry = target.entry;
+			builder.add(EntryStore::buildPath(entry, pathBuffer_), entry.type, entry.size, entry.lastWriteTime,
+				target.contentHash);
+		}
+		std::vector<char> image;
+		if(!builder.build(image)){
+			std::cerr << "`FbNΏۂ'" << cmdline_.getDBFile() << "'ɏ߂܂B" << std::endl;
+			return;
+		}
+
+		targetsPrev_.close(); // Windows cannot replace a mapped file
+		AtomicFileWriter writer(cmdline_.getDBFile());
+		if(!writer.isOpen()){
 			std::cerr << "o̓t@C'" << cmdline_.getDBFile() << "'J܂łB" << std::endl;
+			readDB();
 			return;
 		}
-		writeBinary(ofs, DB_MAGIC);
-		writeBinary(ofs, targets_.size());
-		for(const DirectoryEntry &entry : targets_){
-			writeStringBinary(ofs, entry.getPath());
-			writeBinary(ofs, entry.getFileType());
-			writeBinary(ofs, entry.getFileSize());
-			writeBinary(ofs, entry.getLastWriteTime());
+		writer.getStream().write(image.data(), image.size());
+		if(!writer.commit()){
+			std::cerr << "o̓t@C'" << cmdline_.getDBFile() << "'݂̏Ɏs܂B" << std::endl;
+			readDB();
+			return;
 		}
+		targetsPrev_.assign(image); // the new baseline for recheck()
 	}
 };
+template<typename Policy>
+const unsigned int CheckingMethod2<Policy>::DB_MAGIC;
 static CheckingMethodFactory::Reg<CheckingMethod2> reg2_0("2");
 static CheckingMethodFactory::Reg<CheckingMethod2> reg2_1("filestat");
 static CheckingMethodFactory::Reg<CheckingMethod2> reg2_2(""); //default
 
+
+/**
+ * filestatɉāAt@C̓ẽnbVl(XXH64)ωƂɕωƌȂASYłB
+ *
+ * eǂނ̂̓TCYXVDBƈقȂt@CłB
+ * XVςēeꍇ͕ωĂȂƌȂ܂(DB̍XV͏܂)B
+ */
+template<typename Policy>
+class CheckingMethod3 : public CheckingMethod2<Policy>
+{
+public:
+	CheckingMethod3(const CommandLine &cmdline)
+		: CheckingMethod2<Policy>(cmdline, true)
+	{}
+};
+static CheckingMethodFactory::Reg<CheckingMethod3> reg3_0("3");
+static CheckingMethodFactory::Reg<CheckingMethod3> reg3_1("content");
+
+
+/**
+ * fBNgɁẢ̑SẴ`FbNΏ(OA^CvATCYAXV)̃nbVlKwIɋ߂ĔrASYł(Merkle)B
+ *
+ * DBt@C̗eʂdirsummaryƓfBNgɔႵ܂AfilestatƓ悤ɐmɕωoł܂B
+ * R}hCŒڎw肵`FbNΏۂ́A̉zIȃfBNg([g)̉ɂ̂ƂĈ܂B
+ * -v̂Ƃ́AnbVlقȂ镔؂ǂāAωfBNg\܂B
+ */
+template<typename Policy>
+class CheckingMethod4 : public CheckingMethod
+{
+	struct DirNode
+	{
+		PathSlice path; ///< store_(܂prevArena_)ɂ
+		std::uint64_t subtreeHash; ///< ̃`FbNΏۂƃTufBNgsubtreeHash
+		std::uint64_t filesHash; ///< ̃`FbNΏۂ̂
+		std::uint32_t parent;
+		std::uint32_t firstChild; ///< q̓pXnextSiblingłȂ
+		std::uint32_t nextSibling;
+		DirNode() : subtreeHash(0), filesHash(0), parent(NO_NODE), firstChild(NO_NODE), nextSibling(NO_NODE)
+		{
+			path.data = nullptr;
+			path.size = 0;
+		}
+	};
+	static const std::uint32_t NO_NODE = ~0u;
+	EntryStore store_; ///< ̑ŏW߂Ggnodes_̃pX
+	std::vector<DirNode> nodes_; ///< sB[0]̓[g
+	MonotonicArena prevArena_; ///< nodesPrev_̃pX
+	std::vector<DirNode> nodesPrev_;
+public:
+	CheckingMethod4(const CommandLine &cmdline)
+		: CheckingMethod(cmdline, FILEATTR_ALL)
+	{
+		enablePrefetch<Policy>();
+	}
+
+	bool check()
+	{
+		nodes_.assign(1, DirNode());
+		std::vector<EntryStore::Entry> targets;
+		std::vector<EntryStore::Entry> subdirs;
+		for (auto target : cmdline_.getTargets()){
+			collectEntry(getTargetPathEntry(target), nullptr, targets, subdirs);
+		}
+		hashDirectory(0, targets, subdirs);
+
+		if (nodesPrev_.empty() || nodes_[0].subtreeHash != nodesPrev_[0].subtreeHash){
+			setChanged();
+			if (nodesPrev_.empty()){
+				recordChange(RunStats::CHANGE_ADD, ChangeSet::TYPE_TOP_LEVEL, PathString());
+				if (cmdline_.optVerbose()){
+					std::cout << "change: no previous tree" << std::endl;
+				}
+			}
+			else if (cmdline_.optVerbose() || stats_ || changeSet_){
+				const RunStats::PhaseTimer timer(stats_, RunStats::PHASE_COMPARE);
+				reportChangedSubtree(0, 0);
+			}
+		}
+		return getChanged();
+	}
+private:
+	/// dirnullptr̂Ƃ([g)́AentrỹpXŜprefixƂĊi[܂B
+	void collectEntry(const DirectoryEntry &entry, const EntryStore::DirectoryRef *dir,
+		std::vector<EntryStore::Entry> &targets, std::vector<EntryStore::Entry> &subdirs)
+	{
+		const bool isTarget = isEntryTarget<Policy>(entry);
+		const bool isSubdir = isEntryToDescend<Policy>(entry);
+		if (!isTarget && !isSubdir){
+			return;
+		}
+		entry.loadWantedAttributes(); // while the enumerator's directory handle is still usable
+		const EntryStore::Entry stored = dir
+			? store_.makeEntry(*dir, entry)
+			: store_.makeEntry(entry.getPath(), entry.getFileType(), entry.getFileSize(), entry.getLastWriteTime());
+		if (isTarget){
+			targets.push_back(stored);
+		}
+		if (isSubdir){
+			subdirs.push_back(stored);
+		}
+	}
+	/**
+	 * nodes_[nodeIndex]̃nbVlÃ`FbNΏtargetsƃTufBNgsubdirs狁߂܂B
+	 * TufBNg͍ċAIɏ܂B[gł̓t@C̑ɃpXŜg܂B
+	 */
+	void hashDirectory(std::uint32_t nodeIndex, std::vector<EntryStore::Entry> &targets, std::vector<EntryStore::Entry> &subdirs)
+	{
+		// Entries under the root have the whole path in the prefix and an empty name.
+		const bool isRoot = nodeIndex == 0;
+		const auto nameOf = [isRoot](const EntryStore::Entry &entry){ return isRoot ? entry.prefix : entry.name;};
+		const auto byName = [&](const EntryStore::Entry &a, const EntryStore::Entry &b){ return nameOf(a) < nameOf(b);};
+		std::sort(targets.begin(), targets.end(), byName);
+		std::sort(subdirs.begin(), subdirs.end(), byName);
+
+		XXH64State filesState;
+		for (const EntryStore::Entry &entry : targets){
+			hashName(filesState, nameOf(entry));
+			const std::uint32_t type = entry.type;
+			filesState.update(&type, sizeof(type));
+			filesState.update(&entry.size, sizeof(entry.size));
+			filesState.update(&entry.lastWriteTime, sizeof(entry.lastWriteTime));
+		}
+		nodes_[nodeIndex].filesHash = filesState.digest();
+
+		XXH64State subtreeState;
+		subtreeState.update(&nodes_[nodeIndex].filesHash, sizeof(std::uint64_t));
+		std::uint32_t prevChild = NO_NODE;
+		for (const EntryStore::Entry &subdir : subdirs){
+			const std::uint32_t childIndex = static_cast<std::uint32_t>(nodes_.size());
+			nodes_.push_back(DirNode());
+			nodes_[childIndex].path = store_.storePath(subdir);
+			nodes_[childIndex].parent = nodeIndex;
+			(prevChild == NO_NODE ? nodes_[nodeIndex].firstChild : nodes_[prevChild].nextSibling) = childIndex;
+			prevChild = childIndex;
+
+			const PathString path = nodes_[childIndex].path.str();
+			const EntryStore::DirectoryRef dirRef = store_.internDirectory(path);
+			std::vector<EntryStore::Entry> childTargets;
+			std::vector<EntryStore::Entry> childSubdirs;
+			for (SharedScan::Enumerator etor(sharedScan_, path, requiredAttributes_, prefetch_); !etor.isEnd(); etor.increment()){
+				collectEntry(etor.getEntry(), &dirRef, childTargets, childSubdirs);
+			}
+			hashDirectory(childIndex, childTargets, childSubdirs);
+
+			hashName(subtreeState, nameOf(subdir));
+			subtreeState.update(&nodes_[childIndex].subtreeHash, sizeof(std::uint64_t));
+		}
+		nodes_[nodeIndex].subtreeHash = subtreeState.digest();
+	}
+	static void hashName(XXH64State &state, const PathSlice &name)
+	{
+		static const PathChar terminator = PATH_CHAR_L('\0');
+		state.update(name.data, name.size * sizeof(PathChar));
+		state.update(&terminator, sizeof(PathChar));
+	}
+	/**
+	 * nbVlقȂ镔؂ǂāAωfBNg𐔂A-v̂Ƃ͕\A-changeŝƂ͈ꗗɉ܂B
+	 */
+	void reportChangedSubtree(std::uint32_t curr, std::uint32_t prev)
+	{
+		const DirNode &currNode = nodes_[curr];
+		const DirNode &prevNode = nodesPrev_[prev];
+		if (currNode.subtreeHash == prevNode.subtreeHash){
+			return;
+		}
+		if (currNode.filesHash != prevNode.filesHash){
+			if (curr == 0){
+				recordChange(RunStats::CHANGE_MODIFY, ChangeSet::TYPE_TOP_LEVEL, PathString());
+			}
+			else{
+				recordChange(RunStats::CHANGE_MODIFY, ChangeSet::TYPE_DIRECTORY, currNode.path.str());
+			}
+			if (cmdline_.optVerbose()){
+				if (curr == 0){
+					std::cout << "change: top level target" << std::endl;
+				}
+				else{
+					std::cout << "change(change directory): " << currNode.path << std::endl;
+				}
+			}
+		}
+		// Both children lists are in path order.
+		std::uint32_t i = currNode.firstChild;
+		std::uint32_t j = prevNode.firstChild;
+		while (i != NO_NODE || j != NO_NODE){
+			const int order = (i == NO_NODE) ? 1
+				: (j == NO_NODE) ? -1
+				: nodes_[i].path.compare(nodesPrev_[j].path);
+			if (order < 0){
+				recordChange(RunStats::CHANGE_ADD, ChangeSet::TYPE_DIRECTORY, nodes_[i].path.str());
+				if (cmdline_.optVerbose()){
+					std::cout << "change(add directory): " << nodes_[i].path << std::endl;
+				}
+				i = nodes_[i].nextSibling;
+			}
+			else if (order > 0){
+				recordChange(RunStats::CHANGE_DELETE, ChangeSet::TYPE_DIRECTORY, nodesPrev_[j].path.str());
+				if (cmdline_.optVerbose()){
+					std::cout << "change(delete directory): " << nodesPrev_[j].path << std::endl;
+				}
+				j = nodesPrev_[j].nextSibling;
+			}
+			else{
+				reportChangedSubtree(i, j);
+				i = nodes_[i].nextSibling;
+				j = nodesPrev_[j].nextSibling;
+			}
+		}
+	}
+
+public:
+	static const unsigned int DB_MAGIC = 'd'|('f'<<8)|('c'<<16)|('4'<<24);
+	virtual void readDB()
+	{
+		countSystemCall(SYSCALL_FILE_OPEN);
+		std::ifstream ifs(cmdline_.getDBFile().c_str(), std::ios::binary);
+		if (!ifs){
+			return; //cannot open.
+		}
+		if (readBinary<unsigned int>(ifs) != DB_MAGIC){
+			return;
+		}
+		const std::uint32_t nodeCount = readBinary<std::uint32_t>(ifs);
+		if (!ifs || nodeCount == 0){
+			return;
+		}
+		MonotonicArena arena;
+		std::vector<DirNode> nodes(nodeCount);
+		std::vector<std::uint32_t> lastChildren(nodeCount, NO_NODE);
+		for (std::uint32_t i = 0; i < nodeCount; ++i){
+			DirNode &node = nodes[i];
+			node.path = readStringBinary(ifs, arena);
+			node.subtreeHash = readBinary<std::uint64_t>(ifs);
+			node.filesHash = readBinary<std::uint64_t>(ifs);
+			node.parent = readBinary<std::uint32_t>(ifs);
+			if (!ifs || (i == 0) != (node.parent == NO_NODE) || (i != 0 && node.parent >= i)){
+				return;
+			}
+			if (i != 0){
+				std::uint32_t &lastChild = lastChildren[node.parent];
+				(lastChild == NO_NODE ? nodes[node.parent].firstChild : nodes[lastChild].nextSibling) = i;
+				lastChild = i;
+			}
+		}
+		prevArena_.swap(arena);
+		nodesPrev_.swap(nodes);
+	}
+	virtual void writeDB()
+	{
+		AtomicFileWriter writer(cmdline_.getDBFile());
+		if (!writer.isOpen()){
+			std::cerr << "o̓t@C'" << cmdline_.getDBFile() << "'J܂łB" << std::endl;
+			return;
+		}
+		std::ostream &ofs = writer.getStream();
+		writeBinary(ofs, DB_MAGIC);
+		writeBinary(ofs, static_cast<std::uint32_t>(nodes_.size()));
+		for (const DirNode &node : nodes_){
+			writeStringBinary(ofs, node.path);
+			writeBinary(ofs, node.subtreeHash);
+			writeBinary(ofs, node.filesHash);
+			writeBinary(ofs, node.parent);
+		}
+		if (!writer.commit()){
+			std::cerr << "o̓t@C'" << cmdline_.getDBFile() << "'݂̏Ɏs܂B" << std::endl;
+		}
+	}
+};
+template<typename Policy>
+const std::uint32_t CheckingMethod4<Policy>::NO_NODE;
+template<typename Policy>
+const unsigned int CheckingMethod4<Policy>::DB_MAGIC;
+static CheckingMethodFactory::Reg<CheckingMethod4> reg4_0("4");
+static CheckingMethodFactory::Reg<CheckingMethod4> reg4_1("merkle");
+
+
+/**
+ * -connectŎw肵f[(-daemonŋNdetfc)ɖ₢킹ĕω𔻒肵܂B
+ *
+ * DB݂̏̓f[sÃvZX̓f[̏o͂\ăR}hs邾łB
+ * ʐMɎsƂ́AŜߕωƌȂ܂B
+ */
+class RemoteCheckingMethod : public CheckingMethod
+{
+	LocalSocket socket_;
+public:
+	RemoteCheckingMethod(const CommandLine &cmdline)
+		: CheckingMethod(cmdline, 0)
+	{}
+
+	bool connect()
+	{
+		return socket_.connect(cmdline_.getConnectSocket());
+	}
+
+	virtual bool check()
+	{
+		std::ostringstream request;
+		writeStringBinary(request, "check");
+		writeStringBinary(request, getCurrentDirectory());
+		writeBinary(request, static_cast<std::uint32_t>(cmdline_.getQueryArgs().size()));
+		for (const std::string &arg : cmdline_.getQueryArgs()){
+			writeStringBinary(request, arg);
+		}
+		bool changed;
+		bool dbUpdateNeeded;
+		if (!query(request.str(), changed, dbUpdateNeeded)){
+			setChanged();
+			return true;
+		}
+		if (changed){
+			setChanged();
+		}
+		if (dbUpdateNeeded){
+			setDBUpdateNeeded();
+		}
+		return getChanged();
+	}
+	virtual void readDB()
+	{
+		// by the daemon
+	}
+	virtual void writeDB()
+	{
+		std::ostringstream request;
+		writeStringBinary(request, "writedb");
+		bool changed;
+		bool dbUpdateNeeded;
+		query(request.str(), changed, dbUpdateNeeded);
+	}
+private:
+	bool query(const std::string &request, bool &changed, bool &dbUpdateNeeded)
+	{
+		std::string response;
+		if (!socket_.sendMessage(request) || !socket_.receiveMessage(response)){
+			std::cerr << "f['" << cmdline_.getConnectSocket() << "'Ƃ̒ʐMɎs܂B" << std::endl;
+			return false;
+		}
+		std::istringstream is(response);
+		changed = readBinary<std::uint8_t>(is) != 0;
+		dbUpdateNeeded = readBinary<std::uint8_t>(is) != 0;
+		std::cout << readStringBinary(is);
+		std::cerr << readStringBinary(is);
+		std::cout.flush();
+		return static_cast<bool>(is);
+	}
+};
+
+/**
+ * ĂԁAstd::coutstd::cerrւ̏o͂𕶎ɗ߂܂B
+ */
+class OutputCapture
+{
+	std::ostringstream out_;
+	std::ostringstream err_;
+	std::streambuf *oldOut_;
+	std::streambuf *oldErr_;
+public:
+	OutputCapture()
+		: oldOut_(std::cout.rdbuf(out_.rdbuf()))
+		, oldErr_(std::cerr.rdbuf(err_.rdbuf()))
+	{}
+	~OutputCapture()
+	{
+		std::cout.rdbuf(oldOut_);
+		std::cerr.rdbuf(oldErr_);
+	}
+	std::string getOutput() const { return out_.str();}
+	std::string getError() const { return err_.str();}
+};
+
 }//namespace detfc
 
 
 
+// The benchmark harness includes this file with DETFC_NO_MAIN to reuse the checking methods,
+// so leave out main() and everything only it uses.
+#if !defined(DETFC_NO_MAIN)
+namespace {
+using namespace detfc;
+
+void writeDB(CheckingMethod &checker, RunStats *stats)
+{
+	const RunStats::PhaseTimer timer(stats, RunStats::PHASE_WRITE_DB);
+	checker.writeDB();
+	if(stats){
+		stats->setDBWritten();
+	}
+}
+
+/**
+ * -e-oñR}hsďIXe[^XԂ܂BinputnullptrłȂΕW͂ɓn܂B
+ */
+int runCommand(const std::string &command, const std::string *input)
+{
+	ChildProcess child(command);
+	if(!child.start(input != nullptr)){
+		std::cerr << "R}h'" << command << "'sł܂łB" << std::endl;
+		return 127;
+	}
+	if(input && !input->empty()){
+		child.writeInput(input->data(), input->size());
+	}
+	return child.wait();
+}
+
+/**
+ * ωoƂ̃R}hs܂BSĐƂtrueԂ܂B
+ * -ẽR}hƁAvω-oñR}hA-j̐܂ŕsĎs܂(sĂc͎s܂)B
+ * ω̈ꗗƂ(fastA-connect)-oñR}hSĎs܂B
+ */
+bool runCommands(const CommandLine &cmdline, ChangeSet *changeSet)
+{
+	std::vector<std::function<int()>> commands;
+	if (!cmdline.getCommandChanged().empty()){
+		if (changeSet && changeSet->hasCommand()){
+			commands.push_back([changeSet](){ return changeSet->finishCommand();});
+		}
+		else{
+			commands.push_back([&cmdline](){ return runCommand(cmdline.getCommandChanged(), nullptr);});
+		}
+	}
+	const std::vector<CommandRule> &rules = cmdline.getCommandRules();
+	const bool routes = changeSet && changeSet->getRecordCount() > 0;
+	for (std::size_t i = 0; i < rules.size(); ++i){
+		if (routes && !changeSet->isRuleMatched(i)){
+			continue;
+		}
+		if (cmdline.optVerbose()){
+			std::cout << "run(" << rules[i].pattern << "): " << rules[i].command << std::endl;
+		}
+		const std::string *input = changeSet && cmdline.optChangesToCommand() ? &changeSet->getRuleRecords(i) : nullptr;
+		commands.push_back([&rules, i, input](){ return runCommand(rules[i].command, input);});
+	}
+
+	std::vector<int> results(commands.size(), 0);
+	const unsigned int threads = static_cast<unsigned int>(std::min<std::size_t>(cmdline.getJobs(), commands.size()));
+	if (threads > 1){
+		WorkStealingThreadPool pool(threads);
+		for (std::size_t i = 0; i < commands.size(); ++i){
+			pool.submit([&, i](unsigned int){ results[i] = commands[i]();});
+		}
+		pool.wait();
+	}
+	else{
+		for (std::size_t i = 0; i < commands.size(); ++i){
+			results[i] = commands[i]();
+		}
+	}
+	return std::all_of(results.begin(), results.end(), [](int ret){ return ret == 0;});
+}
+
+/**
+ * check()̌ʂɏ]ăR}hsADBXV܂B
+ * -changesstdin̂Ƃ́AeR}h̕W͂ɕω̈ꗗ(-oñR}hɂ͈v̂)n܂B
+ * R}hsƂ(-iꍇ)falseԂ܂B
+ */
+bool processCheckResult(CheckingMethod &checker, bool changed, const CommandLine &cmdline, RunStats *stats, ChangeSet *changeSet)
+{
+	if(changed){
+		if (cmdline.optWriteDBBeforeCommand()){
+			writeDB(checker, stats);
+		}
+
+		if (!cmdline.getCommandChanged().empty() || !cmdline.getCommandRules().empty()){
+			const RunStats::PhaseTimer timer(stats, RunStats::PHASE_COMMAND);
+			if (!runCommands(cmdline, changeSet) && !cmdline.optIgnoreFailureCommand()){
+				return false; // command failure
+			}
+		}
+
+		if (cmdline.optWriteDBAfterCommand()){
+			writeDB(checker, stats);
+		}
+	}
+	else if (checker.isDBUpdateNeeded() && cmdline.optWriteDB()){
+		writeDB(checker, stats);
+	}
+	return true;
+}
+
+/**
+ * checkerŒ(changesnullptrłȂrecheck()Œג)Aʂɏ]ăR}hsDBXV܂B
+ * -statŝƂ͒iK̎ԂƃJE^WG[o͂ɏo܂B
+ * -changes, -changesfd̂Ƃ́AR}hsOɕω̈ꗗI܂B
+ * R}hsƂ(-iꍇ)falseԂ܂B
+ */
+bool runCheck(CheckingMethod &checker, const CommandLine &cmdline, const std::vector<FileWatcher::Change> *changes)
+{
+	std::unique_ptr<RunStats> stats(cmdline.optStats() ? new RunStats(cmdline.getDBFile()) : nullptr);
+	checker.setRunStats(stats.get());
+	std::unique_ptr<ChangeSet> changeSet(cmdline.optChanges() || !cmdline.getCommandRules().empty()
+		? new ChangeSet(cmdline.getChangesFile(), cmdline.getChangesFd(), cmdline.optChangesJSONLines() ? ChangeSet::FORMAT_JSON_LINES : ChangeSet::FORMAT_NUL)
+		: nullptr);
+	if(!cmdline.getCommandRules().empty()){
+		changeSet->setRules(cmdline.getCommandRules(), cmdline.optChangesToCommand());
+	}
+	std::unique_ptr<ChildProcess> command;
+	if(cmdline.optChangesToCommand() && !cmdline.getCommandChanged().empty()){
+		// Without -b the command may start on the first change while the check goes on.
+		command.reset(new ChildProcess(cmdline.getCommandChanged()));
+		changeSet->setCommand(command.get(), !cmdline.optWriteDBBeforeCommand());
+	}
+	checker.setChangeSet(changeSet.get());
+	bool changed;
+	if(changes){
+		const RunStats::PhaseTimer timer(stats.get(), RunStats::PHASE_CHECK);
+		changed = checker.recheck(*changes);
+	}
+	else{
+		{
+			const RunStats::PhaseTimer timer(stats.get(), RunStats::PHASE_READ_DB);
+			checker.readDB();
+		}
+		const RunStats::PhaseTimer timer(stats.get(), RunStats::PHASE_CHECK);
+		changed = checker.check();
+	}
+	checker.setChangeSet(nullptr);
+	if(changeSet){
+		changeSet->finish();
+	}
+	const bool succeeded = processCheckResult(checker, changed, cmdline, stats.get(), changeSet.get());
+	checker.setRunStats(nullptr);
+	if(stats){
+		stats->writeJSON(std::cerr, cmdline.getCheckingMethod(), changed);
+	}
+	return succeeded;
+}
+
+/**
+ * SẴ^[QbgĎł悤ɂ܂B
+ * ^[Qbgg̕ω͐efBNgŁA-r̂Ƃ̓^[Qbg̉̕ωꂼĎ܂B
+ */
+bool watchTargets(FileWatcher &watcher, const CommandLine &cmdline)
+{
+	for(const PathString &target : cmdline.getTargets()){
+		const PathString path = getPathWithoutLastRedundantSeparator(target);
+		if(!watcher.addDirectory(getPathDirectoryPart(path), false)){
+			std::cerr << "'" << target << "'Ďł܂łB" << std::endl;
+			return false;
+		}
+		if(cmdline.optIncludesSubEntriesInTarget() && isPathDirectory(target)){
+			if(!watcher.addDirectory(target, true)){
+				std::cerr << "'" << target << "'Ďł܂łB" << std::endl;
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * ω҂Ă̓`FbNƃR}h̎sJԂ܂B߂܂(ĎɎsƂ)B
+ */
+void runWatchLoop(FileWatcher &watcher, std::unique_ptr<CheckingMethod> &checker, CheckingMethodFactory::MethodFactoryFun creator, const CommandLine &cmdline)
+{
+	std::vector<FileWatcher::Change> changes;
+	while(watcher.waitChanges(changes, cmdline.getDebounceTime())){
+		// The parent directories of the targets are watched too.
+		changes.erase(std::remove_if(changes.begin(), changes.end(),
+			[&](const FileWatcher::Change &change){ return !cmdline.isPathInTargets(change.path);}), changes.end());
+		if(changes.empty()){
+			continue;
+		}
+		const bool rechecks = checker->canRecheck();
+		if(!rechecks){
+			checker.reset(creator(cmdline));
+		}
+		// A failed command leaves the DB as it is, so the same changes are reported again next time.
+		runCheck(*checker, cmdline, rechecks ? &changes : nullptr);
+	}
+	std::cerr << "ω̊ĎɎs܂B" << std::endl;
+}
+
+/**
+ * -daemonŋNƂ̏łB
+ *
+ * (ƃfBNg, DBt@C)Ƀ`FbNԂƕω̊ĎێĂA
+ * -connectŋNNCAg̖₢킹ɂ́AO񂩂ωpX𒲂גē܂B
+ * גɑΉĂȂASY(recheck())ł͖SĂ𒲂ׂ܂B
+ * ₢킹͈Ԃɏ܂(NCAgR}hsDB݂̏˗܂ŁÃNCAg͑҂܂)B
+ */
+class QueryServer
+{
+	struct Session
+	{
+		CommandLine cmdline;
+		std::unique_ptr<CheckingMethod> checker;
+		std::unique_ptr<FileWatcher> watcher;
+		FileTime dbTime;
+		FileSize dbSize;
+
+		Session() : dbTime(0), dbSize(0) {}
+		void updateDBStamp()
+		{
+			dbTime = getPathLastWriteTime(cmdline.getDBFile());
+			dbSize = getPathFileSize(cmdline.getDBFile());
+		}
+		bool isDBModified() const
+		{
+			return dbTime != getPathLastWriteTime(cmdline.getDBFile())
+				|| dbSize != getPathFileSize(cmdline.getDBFile());
+		}
+	};
+	std::map<std::pair<PathString, PathString>, std::unique_ptr<Session>> sessions_; ///< (current directory, DB file) => session
+public:
+	bool run(const PathString &socketPath)
+	{
+		if(!LocalSocket::isSupported()){
+			std::cerr << "-daemon is not supported on this platform." << std::endl;
+			return false;
+		}
+		LocalSocket listener;
+		if(!listener.listen(socketPath)){
+			std::cerr << "'" << socketPath << "'Őڑ҂󂯂ł܂łB" << std::endl;
+			return false;
+		}
+		LocalSocket client;
+		while(listener.accept(client)){
+			serveClient(client);
+			client.close();
+		}
+		std::cerr << "'" << socketPath << "'Őڑ󂯕t܂łB" << std::endl;
+		return false;
+	}
+private:
+	void serveClient(LocalSocket &client)
+	{
+		const PathString daemonDirectory = getCurrentDirectory();
+		Session *session = nullptr;
+		std::string request;
+		while(client.receiveMessage(request)){
+			std::istringstream is(request);
+			const std::string type = readStringBinary(is);
+			bool changed = false;
+			bool dbUpdateNeeded = false;
+			std::string output;
+			std::string error;
+			{
+				OutputCapture capture;
+				if(type == "check"){
+					session = check(is, changed);
+				}
+				else if(type == "writedb" && session){
+					session->checker->writeDB();
+					session->updateDBStamp();
+				}
+				else{
+					std::cerr << "Unknown request." << std::endl;
+				}
+				dbUpdateNeeded = session && session->checker->isDBUpdateNeeded();
+				output = capture.getOutput();
+				error = capture.getError();
+			}
+			std::ostringstream response;
+			writeBinary<std::uint8_t>(response, changed);
+			writeBinary<std::uint8_t>(response, dbUpdateNeeded);
+			writeStringBinary(response, output);
+			writeStringBinary(response, error);
+			if(!client.sendMessage(response.str())){
+				break;
+			}
+		}
+		setCurrentDirectory(daemonDirectory);
+	}
+	Session *check(std::istream &is, bool &changed)
+	{
+		const PathString directory = readStringBinary(is);
+		const std::uint32_t argCount = readBinary<std::uint32_t>(is);
+		std::vector<std::string> args(1, "detfc");
+		for(std::uint32_t i = 0; is && i < argCount; ++i){
+			args.push_back(readStringBinary(is));
+		}
+		std::vector<char *> argv;
+		for(std::string &arg : args){
+			argv.push_back(&arg[0]);
+		}
+		CommandLine query;
+		if(!is || !setCurrentDirectory(directory) || !query.parse(static_cast<int>(argv.size()), argv.data())){
+			std::cerr << "₢킹słB" << std::endl;
+			changed = true;
+			return nullptr;
+		}
+		CheckingMethodFactory::MethodFactoryFun creator = CheckingMethodFactory::getMethod(query.getCheckingMethod());
+		if(!creator){
+			std::cerr << "Unknown checking method name '" << query.getCheckingMethod() << "' specified." << std::endl;
+			changed = true;
+			return nullptr;
+		}
+
+		std::unique_ptr<Session> &sessionPtr = sessions_[std::make_pair(directory, query.getDBFile())];
+		if(!sessionPtr){
+			sessionPtr.reset(new Session());
+		}
+		Session &session = *sessionPtr;
+		if(session.checker && session.watcher && session.cmdline.hasSameScope(query)){
+			session.cmdline = query; // -v etc. of this query
+			if(session.isDBModified()){
+				// written by another process
+				session.checker->readDB();
+				session.updateDBStamp();
+			}
+			std::vector<FileWatcher::Change> changes;
+			if(session.watcher->readPendingChanges(changes)){
+				changes.erase(std::remove_if(changes.begin(), changes.end(),
+					[&](const FileWatcher::Change &change){ return !session.cmdline.isPathInTargets(change.path);}), changes.end());
+				changed = session.checker->recheck(changes);
+				return &session;
+			}
+		}
+
+		// first query, different scope or watching failed
+		session.watcher.reset();
+		session.cmdline = query;
+		session.checker.reset(creator(session.cmdline));
+		if(session.checker->canRecheck() && FileWatcher::isSupported()){
+			session.watcher.reset(new FileWatcher());
+			if(!watchTargets(*session.watcher, session.cmdline)){
+				session.watcher.reset();
+			}
+		}
+		session.checker->readDB();
+		session.updateDBStamp();
+		changed = session.checker->check();
+		return &session;
+	}
+};
+
+/**
+ * 񂾂ׂďIƂ̏IXe[^XԂ܂B
+ * -quickexit̂Ƃ́AnɂŃvZXI܂B
+ */
+int finishRun(int status, const CommandLine &cmdline)
+{
+	if(cmdline.optQuickExit()){
+		// The OS reclaims everything at once; skip the destructors of the scan state.
+		std::cout.flush();
+		std::cerr.flush();
+		std::_Exit(status);
+	}
+	return status;
+}
+
+/**
+ * }jtFXgt@Cǂݍ݁As̃WüƂĕԂ܂B
+ * s#Ŏn܂s͖܂B͋󔒂ŋ؂A"ň͂ނƋ󔒂܂߂܂("̒ł\"\\g܂)B
+ */
+bool readManifest(const PathString &file, std::vector<std::vector<std::string>> &jobs)
+{
+	std::ifstream ifs(file.c_str());
+	if(!ifs){
+		std::cerr << "}jtFXgt@C'" << file << "'J܂łB" << std::endl;
+		return false;
+	}
+	std::string line;
+	while(std::getline(ifs, line)){
+		std::vector<std::string> args;
+		std::string::const_iterator it = line.begin();
+		for(;;){
+			while(it != line.end() && std::isspace(static_cast<unsigned char>(*it))){
+				++it;
+			}
+			if(it == line.end() || (args.empty() && *it == '#')){
+				break;
+			}
+			std::string arg;
+			bool quoted = false;
+			for(; it != line.end() && (quoted || !std::isspace(static_cast<unsigned char>(*it))); ++it){
+				if(*it == '"'){
+					quoted = !quoted;
+				}
+				else if(quoted && *it == '\\' && it + 1 != line.end() && (it[1] == '"' || it[1] == '\\')){
+					arg += *++it;
+				}
+				else{
+					arg += *it;
+				}
+			}
+			args.push_back(arg);
+		}
+		if(!args.empty()){
+			jobs.push_back(args);
+		}
+	}
+	return true;
+}
+
+/**
+ * -manifestŎw肳ꂽSẴWuAx̑LĒׂ܂B
+ * eWǘAR}hC(-manifestȊO)Ƀ}jtFXg̍s𑱂̂łB
+ * R}hsWuĂc̃Wuׁ͒AŌɎs̏IXe[^XԂ܂B
+ */
+int runManifest(const CommandLine &cmdline, const char *programName)
+{
+	std::vector<std::vector<std::string>> jobArgs;
+	if(!readManifest(cmdline.getManifestFile(), jobArgs)){
+		return EXIT_FAILURE;
+	}
+	std::vector<CommandLine> jobs(jobArgs.size());
+	for(std::size_t i = 0; i < jobArgs.size(); ++i){
+		std::vector<std::string> args(1, programName);
+		args.insert(args.end(), cmdline.getQueryArgs().begin(), cmdline.getQueryArgs().end());
+		args.insert(args.end(), jobArgs[i].begin(), jobArgs[i].end());
+		std::vector<char *> argv;
+		for(std::string &arg : args){
+			argv.push_back(&arg[0]);
+		}
+		if(!jobs[i].parse(static_cast<int>(argv.size()), argv.data())
+			|| !jobs[i].getManifestFile().empty() || !jobs[i].getDaemonSocket().empty()){
+			std::cerr << "}jtFXg" << (i + 1) << "Ԗڂ̃Wu̎w肪܂B" << std::endl;
+			return EXIT_FAILURE;
+		}
+		if(!CheckingMethodFactory::getMethod(jobs[i].getCheckingMethod())){
+			std::cerr << "Unknown checking method name '" << jobs[i].getCheckingMethod() << "' specified." << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	SharedScan scan;
+	unsigned int threads = 1;
+	bool batchesStat = false;
+	for(const CommandLine &job : jobs){
+		for(const PathString &target : job.getTargets()){
+			scan.addRoot(target, job.optIncludesSubEntriesInTarget());
+		}
+		threads = std::max(threads, job.getJobs());
+		batchesStat = batchesStat || job.optBatchStat();
+	}
+	scan.scan([&](const PathString &filename){
+		return std::any_of(jobs.begin(), jobs.end(), [&](const CommandLine &job){ return job.matchTargetExtension(filename);});
+	}, [&](const DirectoryEntry &dir){
+		return std::any_of(jobs.begin(), jobs.end(), [&](const CommandLine &job){ return !job.getPathFilter().isExcluded(dir);});
+	}, threads, batchesStat);
+
+	std::vector<std::unique_ptr<CheckingMethod>> checkers; // kept until the end for -quickexit
+	bool succeeded = true;
+	for(const CommandLine &job : jobs){
+		checkers.push_back(std::unique_ptr<CheckingMethod>(CheckingMethodFactory::getMethod(job.getCheckingMethod())(job)));
+		checkers.back()->setSharedScan(&scan);
+		if(!runCheck(*checkers.back(), job, nullptr)){
+			succeeded = false;
+		}
+	}
+	return finishRun(succeeded ? EXIT_SUCCESS : EXIT_FAILURE, cmdline);
+}
+
+}//namespace
+
 int main(int argc, char *argv[])
 {
 	using namespace detfc;
@@ -626,35 +2756,51 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE; // command line error
 	}
 
+	if(!cmdline.getDaemonSocket().empty()){
+		QueryServer server;
+		server.run(cmdline.getDaemonSocket());
+		return EXIT_FAILURE;
+	}
+	if(!cmdline.getManifestFile().empty()){
+		return runManifest(cmdline, argv[0]);
+	}
+
 	CheckingMethodFactory::MethodFactoryFun creator = CheckingMethodFactory::getMethod(cmdline.getCheckingMethod());
 	if(!creator){
 		std::cerr << "Unknown checking method name '" << cmdline.getCheckingMethod() << "' specified." << std::endl;
 		return EXIT_FAILURE; // method name error
 	}
-	const std::unique_ptr<CheckingMethod> checker(creator(cmdline));
-	checker->readDB();
-
-	if(checker->check()){
-		if (cmdline.optWriteDBBeforeCommand()){
-			checker->writeDB();
+	FileWatcher watcher;
+	if(cmdline.optWatch()){
+		if(!FileWatcher::isSupported()){
+			std::cerr << "-watch is not supported on this platform." << std::endl;
+			return EXIT_FAILURE;
 		}
-
-		if (!cmdline.getCommandChanged().empty()){
-#if defined(WIN32)
-			const int ret = std::system(cmdline.getCommandChanged().c_str());
-#else
-			const int result = std::system(cmdline.getCommandChanged().c_str());
-			const int ret = WIFEXITED(result) ? WEXITSTATUS(result) : -1;
-#endif
-			if (ret != 0 && !cmdline.optIgnoreFailureCommand()){
-				return EXIT_FAILURE; // command failure
-			}
+		// Start watching before the first scan so that no change is lost.
+		if(!watchTargets(watcher, cmdline)){
+			return EXIT_FAILURE;
 		}
+	}
 
-		if (cmdline.optWriteDBAfterCommand()){
-			checker->writeDB();
+	std::unique_ptr<CheckingMethod> checker;
+	if(!cmdline.getConnectSocket().empty()){
+		std::unique_ptr<RemoteCheckingMethod> remote(new RemoteCheckingMethod(cmdline));
+		if(remote->connect()){
+			checker = std::move(remote);
+		}
+		else if(cmdline.optVerbose()){
+			std::cerr << "f['" << cmdline.getConnectSocket() << "'ɐڑł܂łBڒׂ܂B" << std::endl;
 		}
 	}
-	return EXIT_SUCCESS;
-}
+	if(!checker){
+		checker.reset(creator(cmdline));
+	}
+	const bool succeeded = runCheck(*checker, cmdline, nullptr);
 
+	if(cmdline.optWatch()){
+		runWatchLoop(watcher, checker, creator, cmdline);
+		return EXIT_FAILURE;
+	}
+	return finishRun(succeeded ? EXIT_SUCCESS : EXIT_FAILURE, cmdline); // EXIT_FAILURE: command failure
+}
+#endif
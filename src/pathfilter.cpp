@@ -0,0 +1,235 @@
+#include <algorithm>
+#include "pathfilter.h"
+
+namespace detfc{
+
+namespace{
+
+inline PathChar foldCase(PathChar c)
+{
+	return (c >= PATH_CHAR_L('a') && c <= PATH_CHAR_L('z')) ? static_cast<PathChar>(c - PATH_CHAR_L('a') + PATH_CHAR_L('A')) : c;
+}
+
+/// p^[̔̕rłBWindowsł̓t@CƓ啶ʂ܂B
+inline bool equalsPatternChar(PathChar a, PathChar b)
+{
+#if defined(WIN32)
+	return foldCase(a) == foldCase(b);
+#else
+	return a == b;
+#endif
+}
+
+/// *?܂pA؂܂܂Ȃ[s, s + size)Ɣr܂B
+bool matchesWildcard(const PathString &p, const PathChar *s, std::size_t size)
+{
+	std::size_t pi = 0;
+	std::size_t si = 0;
+	std::size_t starP = PathString::npos;
+	std::size_t starS = 0;
+	while(si < size){
+		if(pi < p.size() && p[pi] == PATH_CHAR_L('*')){
+			starP = pi++;
+			starS = si;
+		}
+		else if(pi < p.size() && (p[pi] == PATH_CHAR_L('?') || equalsPatternChar(p[pi], s[si]))){
+			++pi;
+			++si;
+		}
+		else if(starP != PathString::npos){
+			pi = starP + 1;
+			si = ++starS;
+		}
+		else{
+			return false;
+		}
+	}
+	while(pi < p.size() && p[pi] == PATH_CHAR_L('*')){
+		++pi;
+	}
+	return pi == p.size();
+}
+
+}//namespace
+
+
+PathFilter::PathFilter()
+	: nodes_(1)
+	, hasExtensions_(false)
+{
+	nodes_[0].accepts = false;
+}
+
+void PathFilter::addExtension(const PathString &suffix)
+{
+	hasExtensions_ = true;
+	std::uint32_t node = 0;
+	for(PathString::const_reverse_iterator it = suffix.rbegin(); it != suffix.rend(); ++it){
+		const PathChar c = foldCase(*it);
+		std::vector<std::pair<PathChar, std::uint32_t>> &children = nodes_[node].children;
+		const auto child = std::find_if(children.begin(), children.end(),
+			[c](const std::pair<PathChar, std::uint32_t> &edge){ return edge.first == c;});
+		if(child != children.end()){
+			node = child->second;
+		}
+		else{
+			const std::uint32_t next = static_cast<std::uint32_t>(nodes_.size());
+			children.push_back(std::make_pair(c, next));
+			nodes_.push_back(TrieNode());
+			nodes_.back().accepts = false;
+			node = next;
+		}
+	}
+	nodes_[node].accepts = true;
+}
+
+bool PathFilter::matchesExtension(const PathString &filename) const
+{
+	if(!hasExtensions_){
+		return true;
+	}
+	std::uint32_t node = 0;
+	for(PathString::const_reverse_iterator it = filename.rbegin(); ; ++it){
+		if(nodes_[node].accepts){
+			return true;
+		}
+		if(it == filename.rend()){
+			return false;
+		}
+		const PathChar c = foldCase(*it);
+		const std::vector<std::pair<PathChar, std::uint32_t>> &children = nodes_[node].children;
+		const auto child = std::find_if(children.begin(), children.end(),
+			[c](const std::pair<PathChar, std::uint32_t> &edge){ return edge.first == c;});
+		if(child == children.end()){
+			return false;
+		}
+		node = child->second;
+	}
+}
+
+PathFilter::Match PathFilter::classify(const DirectoryEntry &entry) const
+{
+	if(isExcluded(entry)){
+		return MATCH_EXCLUDED;
+	}
+	if(!matchesExtension(entry.getFilename())){
+		return MATCH_UNSELECTED;
+	}
+	if(!includes_.empty() && !matchesAny(includes_, entry.getDirectory(), entry.getFilename())){
+		return MATCH_UNSELECTED;
+	}
+	return MATCH_SELECTED;
+}
+
+PathFilter::Pattern PathFilter::compilePattern(const PathString &pattern)
+{
+	Pattern compiled;
+	compiled.nameOnly = findPathSeparator(pattern) == PathString::npos;
+	std::size_t pos = 0;
+	for(;;){
+		const std::size_t sep = findPathSeparator(pattern, pos);
+		const PathString text = pattern.substr(pos, sep == PathString::npos ? PathString::npos : sep - pos);
+		Segment segment;
+		segment.kind = text == PATH_CHAR_L("**") ? SEGMENT_ANY_DEPTH
+			: text.find_first_of(PATH_CHAR_L("*?")) != PathString::npos ? SEGMENT_WILDCARD
+			: SEGMENT_LITERAL;
+		segment.text = text;
+		// a/**/**/b is the same as a/**/b
+		if(!(segment.kind == SEGMENT_ANY_DEPTH && !compiled.segments.empty() && compiled.segments.back().kind == SEGMENT_ANY_DEPTH)){
+			compiled.segments.push_back(segment);
+		}
+		if(sep == PathString::npos){
+			break;
+		}
+		pos = sep + 1;
+	}
+	return compiled;
+}
+
+bool PathFilter::matchesAny(const std::vector<Pattern> &patterns, const PathString &dir, const PathString &name, bool anyName)
+{
+	Cursor start;
+	start.pos = 0;
+	start.part = dir.empty() ? 1 : 0;
+	Cursor nameOnly;
+	nameOnly.pos = 0;
+	nameOnly.part = 1;
+	for(const Pattern &pattern : patterns){
+		if(matchesPattern(pattern, 0, pattern.nameOnly ? nameOnly : start, dir, name, anyName)){
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PathFilter::matchesPattern(const Pattern &pattern, std::size_t index, Cursor cursor, const PathString &dir, const PathString &name, bool anyName)
+{
+	for(; index < pattern.segments.size(); ++index){
+		const Segment &segment = pattern.segments[index];
+		if(segment.kind == SEGMENT_ANY_DEPTH){
+			if(index + 1 == pattern.segments.size()){
+				return true;
+			}
+			// try the rest of the pattern at every remaining depth
+			for(;;){
+				if(matchesPattern(pattern, index + 1, cursor, dir, name, anyName)){
+					return true;
+				}
+				if(cursor.part == 2){
+					return false;
+				}
+				if(cursor.part == 1){
+					cursor.part = 2;
+				}
+				else{
+					const std::size_t sep = findPathSeparator(dir, cursor.pos);
+					cursor.pos = sep == PathString::npos ? dir.size() : sep + 1;
+					if(cursor.pos >= dir.size()){
+						cursor.part = 1;
+					}
+				}
+			}
+		}
+
+		if(cursor.part == 2){
+			return false;
+		}
+		if(cursor.part == 1){
+			if(!anyName && !matchesSegment(segment, name.data(), name.size())){
+				return false;
+			}
+			cursor.part = 2;
+		}
+		else{
+			const std::size_t sep = findPathSeparator(dir, cursor.pos);
+			const std::size_t end = sep == PathString::npos ? dir.size() : sep;
+			if(!matchesSegment(segment, dir.data() + cursor.pos, end - cursor.pos)){
+				return false;
+			}
+			// a trailing separator (a target given as "dir/") does not make an empty part
+			cursor.pos = end + 1;
+			if(cursor.pos >= dir.size()){
+				cursor.part = 1;
+			}
+		}
+	}
+	return cursor.part == 2;
+}
+
+bool PathFilter::matchesSegment(const Segment &segment, const PathChar *s, std::size_t size)
+{
+	if(segment.kind == SEGMENT_LITERAL){
+		if(segment.text.size() != size){
+			return false;
+		}
+		for(std::size_t i = 0; i < size; ++i){
+			if(!equalsPatternChar(segment.text[i], s[i])){
+				return false;
+			}
+		}
+		return true;
+	}
+	return matchesWildcard(segment.text, s, size);
+}
+
+}//namespace detfc
@@ -0,0 +1,88 @@
+#ifndef DETFC_PATHFILTER_H_INCLUDED
+#define DETFC_PATHFILTER_H_INCLUDED
+
+#include <cstdint>
+#include <vector>
+#include "filesystem.h"
+
+namespace detfc{
+
+/**
+ * -ext, -include, -excludeŎw肳ꂽA`FbNΏۂIԏłB
+ *
+ * ڔ͑啶ʂȂt̃gCɂ܂Ƃ߁At@C𖖔xȂ邾Ŕ肵܂B
+ * p^[/ŋ؂ɔr܂B*?͋؂܂A**0ȏ̕Ɉv܂B
+ * /܂܂Ȃp^[̓t@CƔrA/܂ރp^[̓pXS(^[Qbg̎w܂)Ɣr܂B
+ * ǉ͓ǂݎpȂ̂ŁÃXbhQƂł܂B
+ */
+class PathFilter
+{
+public:
+	enum Match
+	{
+		MATCH_EXCLUDED, ///< -excludeɈv(fBNgȂ炻ׂ̉Ȃ)
+		MATCH_UNSELECTED, ///< -ext-includeɈvȂ
+		MATCH_SELECTED ///< t@CȂ`FbNΏ
+	};
+
+	PathFilter();
+
+	void addExtension(const PathString &suffix);
+	void addInclude(const PathString &pattern) { includes_.push_back(compilePattern(pattern));}
+	void addExclude(const PathString &pattern) { excludes_.push_back(compilePattern(pattern));}
+
+	/// (SẴGgMATCH_SELECTEDɂȂ)ǂԂ܂B
+	bool isEmpty() const { return !hasExtensions_ && includes_.empty() && excludes_.empty();}
+	/// filename-ext̐ڔ̂ǂꂩŏIĂ邩ǂԂ܂(-extƂtrue)B
+	bool matchesExtension(const PathString &filename) const;
+	/// entry-excludêǂꂩɈv邩ǂԂ܂B
+	bool isExcluded(const DirectoryEntry &entry) const { return !excludes_.empty() && matchesAny(excludes_, entry.getDirectory(), entry.getFilename());}
+	/// OƃpXentry𕪗ނ܂(͎擾܂)B
+	Match classify(const DirectoryEntry &entry) const;
+	/// dir̒-includêǂꂩɈvGg蓾邩ǂAO킸ɕԂ܂(-includeƂtrue)B
+	bool mayIncludeEntryIn(const PathString &dir) const { return includes_.empty() || matchesAny(includes_, dir, PathString(), true);}
+
+private:
+	struct TrieNode
+	{
+		std::vector<std::pair<PathChar, std::uint32_t>> children; ///< ̕(啶) => nodes_̓Y
+		bool accepts; ///< ܂łŐڔ̂ǂꂩɈv
+	};
+	std::vector<TrieNode> nodes_; ///< nodes_[0]
+	bool hasExtensions_;
+
+	enum SegmentKind
+	{
+		SEGMENT_LITERAL,
+		SEGMENT_WILDCARD,
+		SEGMENT_ANY_DEPTH ///< **
+	};
+	struct Segment
+	{
+		SegmentKind kind;
+		PathString text;
+	};
+	struct Pattern
+	{
+		std::vector<Segment> segments;
+		bool nameOnly;
+	};
+	std::vector<Pattern> includes_;
+	std::vector<Pattern> excludes_;
+
+	/// pX̕ɂȂʒułBdiř̕name̕ƂĕԂ܂B
+	struct Cursor
+	{
+		std::size_t pos;
+		int part; ///< 0: dir̒, 1: name, 2: I
+	};
+
+	static Pattern compilePattern(const PathString &pattern);
+	/// anyNamêƂ́AnamȇɂǂȖOɂv̂ƂĔr܂B
+	static bool matchesAny(const std::vector<Pattern> &patterns, const PathString &dir, const PathString &name, bool anyName = false);
+	static bool matchesPattern(const Pattern &pattern, std::size_t index, Cursor cursor, const PathString &dir, const PathString &name, bool anyName);
+	static bool matchesSegment(const Segment &segment, const PathChar *s, std::size_t size);
+};
+
+}//namespace detfc
+#endif
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include "sharedscan.h"
+#include "threadpool.h"
+
+namespace detfc{
+
+void SharedScan::addRoot(const PathString &path, bool recursive)
+{
+	bool &r = roots_[path];
+	r = r || recursive;
+}
+
+void SharedScan::scan(const AttributeFilter &wantsAttributes, const DirectoryFilter &descends, unsigned int threads, bool batchesStat)
+{
+	wantsAttributes_ = wantsAttributes;
+	descends_ = descends;
+	if(batchesStat){
+		prefetch_ = [this](const DirectoryEntry &entry){ return entry.isDirectory() || wantsAttributes_(entry.getFilename());};
+	}
+	std::unique_ptr<WorkStealingThreadPool> pool;
+	if(threads > 1){
+		pool.reset(new WorkStealingThreadPool(threads));
+	}
+	pool_ = pool.get();
+	workerStores_.clear();
+	for(unsigned int i = 0; i < (pool ? pool->getThreadCount() : 1); ++i){
+		workerStores_.push_back(std::unique_ptr<EntryStore>(new EntryStore()));
+	}
+
+	for(const auto &root : roots_){
+		const DirectoryEntry entry = getPathDirectoryEntry(root.first, FILEATTR_ALL);
+		rootEntries_[root.first] = store_.makeEntry(root.first, entry.getFileType(), entry.getFileSize(), entry.getLastWriteTime());
+		if(root.second && entry.isDirectory() && descends_(entry)){
+			const PathString dir = root.first;
+			if(pool_){
+				pool_->submit([this, dir](unsigned int w){ scanDirectory(dir, w);});
+			}
+			else{
+				scanDirectory(dir, 0);
+			}
+		}
+	}
+	if(pool){
+		pool->wait();
+	}
+	pool_ = nullptr;
+	for(std::unique_ptr<EntryStore> &store : workerStores_){
+		store_.absorb(*store);
+	}
+	workerStores_.clear();
+	wantsAttributes_ = AttributeFilter();
+	descends_ = DirectoryFilter();
+	prefetch_ = PrefetchFilter();
+}
+
+void SharedScan::scanDirectory(const PathString &dir, unsigned int workerIndex)
+{
+	const PathString key = getPathChildPrefix(dir);
+	Listing *listing;
+	{
+		// Overlapping roots reach the same directory more than once; only the first one scans it.
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::unique_ptr<Listing> &slot = listings_[key];
+		if(slot){
+			return;
+		}
+		slot.reset(new Listing());
+		listing = slot.get();
+	}
+
+	EntryStore &store = *workerStores_[workerIndex];
+	const EntryStore::DirectoryRef dirRef = store.internDirectory(dir);
+	std::vector<PathString> subdirs;
+	for(DirectoryEntryEnumerator etor(dir, FILEATTR_ALL, prefetch_); !etor.isEnd(); etor.increment()){
+		const DirectoryEntry &entry = etor.getEntry();
+		const FileType type = entry.getFileType();
+		const bool loadsAttributes = type == FILETYPE_DIRECTORY || (type == FILETYPE_REGULAR && wantsAttributes_(entry.getFilename()));
+		listing->entries.push_back(loadsAttributes
+			? store.makeEntry(dirRef, entry)
+			: store.makeEntry(dirRef, entry.getFilename(), type, 0, 0));
+		if(type == FILETYPE_DIRECTORY && descends_(entry)){
+			subdirs.push_back(entry.getPath());
+		}
+	}
+	const std::vector<EntryStore::Entry> &entries = listing->entries;
+	listing->byName.resize(entries.size());
+	for(std::uint32_t i = 0; i < listing->byName.size(); ++i){
+		listing->byName[i] = i;
+	}
+	std::sort(listing->byName.begin(), listing->byName.end(),
+		[&](std::uint32_t a, std::uint32_t b){ return entries[a].name < entries[b].name;});
+
+	for(const PathString &subdir : subdirs){
+		if(pool_){
+			pool_->submit([this, subdir](unsigned int w){ scanDirectory(subdir, w);}, workerIndex);
+		}
+		else{
+			scanDirectory(subdir, workerIndex);
+		}
+	}
+}
+
+const SharedScan::Listing *SharedScan::findListing(const PathString &dir) const
+{
+	const auto it = listings_.find(getPathChildPrefix(dir));
+	return it == listings_.end() ? nullptr : it->second.get();
+}
+
+bool SharedScan::findEntry(const PathString &path, DirectoryEntry &entry) const
+{
+	const EntryStore::Entry *found = nullptr;
+	const auto rootIt = rootEntries_.find(path);
+	if(rootIt != rootEntries_.end()){
+		found = &rootIt->second;
+	}
+	else{
+		const PathString::size_type namePos = getPathFileNamePos(path);
+		const auto it = listings_.find(path.substr(0, namePos));
+		if(it == listings_.end()){
+			return false;
+		}
+		const Listing &listing = *it->second;
+		const PathSlice name = {path.data() + namePos, path.size() - namePos};
+		const auto pos = std::lower_bound(listing.byName.begin(), listing.byName.end(), name,
+			[&](std::uint32_t i, const PathSlice &n){ return listing.entries[i].name < n;});
+		if(pos == listing.byName.end() || listing.entries[*pos].name != name){
+			return false;
+		}
+		found = &listing.entries[*pos];
+	}
+	// split the same way as getPathDirectoryEntry()
+	entry = DirectoryEntry(getPathDirectoryPart(path));
+	entry.assign(getPathFileNamePart(path), found->type, found->size, found->lastWriteTime);
+	return true;
+}
+
+
+SharedScan::Enumerator::Enumerator(const SharedScan *scan, const PathString &dir, FileAttributeMask wantedAttributes, const PrefetchFilter &prefetch)
+	: listing_(nullptr)
+	, index_(0)
+{
+	const Listing * const listing = scan ? scan->findListing(dir) : nullptr;
+	if(listing){
+		listing_ = &listing->entries;
+		entry_ = DirectoryEntry(dir);
+		loadEntry();
+	}
+	else{
+		etor_.reset(new DirectoryEntryEnumerator(dir, wantedAttributes, prefetch));
+	}
+}
+
+void SharedScan::Enumerator::increment()
+{
+	if(etor_){
+		etor_->increment();
+	}
+	else{
+		++index_;
+		loadEntry();
+	}
+}
+
+void SharedScan::Enumerator::loadEntry()
+{
+	if(index_ < listing_->size()){
+		const EntryStore::Entry &stored = (*listing_)[index_];
+		entry_.assign(stored.name.str(), stored.type, stored.size, stored.lastWriteTime);
+	}
+}
+
+}//namespace detfc
@@ -0,0 +1,100 @@
+#ifndef DETFC_SHAREDSCAN_H_INCLUDED
+#define DETFC_SHAREDSCAN_H_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include "filesystem.h"
+#include "entrystore.h"
+
+namespace detfc{
+
+class WorkStealingThreadPool;
+
+/**
+ * ̃Wu(-manifest)ŋLAx̑̌ʂłB
+ *
+ * N_̉x񋓂AfBNg̒̃GgEntryStoreɋL^܂B
+ * eWuDirectoryEntryEnumeratoȓEnumeratorŗ񋓂AgetPathDirectoryEntry()̑findEntry()g܂B
+ * ĂȂpX(N_̏ႤꍇȂ)́Aۂ̃t@CVXe擾܂B
+ * scan()͓̌ǂݎpȂ̂ŁÃXbhQƂł܂B
+ */
+class SharedScan
+{
+public:
+	/// t@C󂯎ATCYƍXV擾邩ǂԂ֐łB
+	typedef std::function<bool(const PathString &filename)> AttributeFilter;
+	/// fBNg󂯎Ả邩ǂԂ֐łB
+	typedef std::function<bool(const DirectoryEntry &dir)> DirectoryFilter;
+
+	SharedScan() : pool_(nullptr) {}
+
+	/// path𑖍̋N_ɉ܂BrecursivêƂ͂̉Sđ܂B
+	void addRoot(const PathString &path, bool recursive);
+	/**
+	 * N_𑖍܂B
+	 * t@C^Cv͑SẴGgɂāATCYƍXV̓fBNgwantsAttributestrueԂt@CɂĎ擾܂B
+	 * descendsfalseԂfBNg̉͑܂(eWuׂƂ͎ۂɗ񋓂܂)B
+	 * threads2ȏ̂Ƃ̓fBNgɕɑ܂B
+	 * batchesStat̂Ƃ́ADirectoryEntryEnumeratorprefetchł܂Ƃ߂Ď擾܂B
+	 */
+	void scan(const AttributeFilter &wantsAttributes, const DirectoryFilter &descends, unsigned int threads, bool batchesStat);
+
+	/// pX̃GgentryɊi[trueԂ܂BĂȂpX̂ƂfalseԂ܂B
+	bool findEntry(const PathString &path, DirectoryEntry &entry) const;
+
+	/**
+	 * DirectoryEntryEnumeratorƓ悤Ɏg񋓎qłB
+	 * fBNg͋L^AłȂ(scannullptr̂Ƃ)ۂɗ񋓂܂B
+	 * prefetch͎ۂɗ񋓂ƂDirectoryEntryEnumeratorɓn܂B
+	 */
+	class Enumerator
+	{
+		const std::vector<EntryStore::Entry> *listing_;
+		std::size_t index_;
+		DirectoryEntry entry_;
+		std::unique_ptr<DirectoryEntryEnumerator> etor_;
+	public:
+		Enumerator(const SharedScan *scan, const PathString &dir, FileAttributeMask wantedAttributes, const PrefetchFilter &prefetch = PrefetchFilter());
+		const DirectoryEntry &getEntry() const { return etor_ ? etor_->getEntry() : entry_;}
+		void increment();
+		bool isEnd() const { return etor_ ? etor_->isEnd() : index_ >= listing_->size();}
+	private:
+		void loadEntry();
+	};
+
+private:
+	/// fBNg̒̃GgłB
+	struct Listing
+	{
+		std::vector<EntryStore::Entry> entries; ///< 񋓂
+		std::vector<std::uint32_t> byName; ///< entries̓Y𖼑Oɕׂ
+	};
+	typedef std::unordered_map<PathString, std::unique_ptr<Listing>> ListingMap; ///< getPathChildPrefix(dir) => ̃Gg
+
+	std::map<PathString, bool> roots_; ///< path => recursive
+	EntryStore store_;
+	std::unordered_map<PathString, EntryStore::Entry> rootEntries_;
+	ListingMap listings_;
+
+	// while scanning
+	AttributeFilter wantsAttributes_;
+	DirectoryFilter descends_;
+	PrefetchFilter prefetch_;
+	WorkStealingThreadPool *pool_;
+	std::vector<std::unique_ptr<EntryStore>> workerStores_;
+	std::mutex mutex_;
+
+	SharedScan(const SharedScan &);
+	SharedScan &operator=(const SharedScan &);
+
+	void scanDirectory(const PathString &dir, unsigned int workerIndex);
+	const Listing *findListing(const PathString &dir) const;
+};
+
+}//namespace detfc
+#endif
@@ -0,0 +1,507 @@
+#include <algorithm>
+#include <map>
+#include <limits>
+#include <cstring>
+#include <string>
+#include "statdb.h"
+
+namespace detfc{
+
+const std::uint32_t FileStatDB::DB_MAGIC;
+const std::uint32_t FileStatDB::DB_VERSION;
+const std::uint32_t FileStatDB::NO_PARENT;
+
+namespace {
+
+typedef std::char_traits<PathChar> PathCharTraits;
+
+std::uint64_t alignUp(std::uint64_t pos, std::uint64_t alignment)
+{
+	return (pos + alignment - 1) / alignment * alignment;
+}
+
+std::uint64_t getBucketCount(std::uint64_t recordCount)
+{
+	if(recordCount == 0){
+		return 0;
+	}
+	// load factor <= 0.5
+	std::uint64_t bucketCount = 1;
+	while(bucketCount < recordCount * 2){
+		bucketCount <<= 1;
+	}
+	return bucketCount;
+}
+
+/// fBNg\̃L[(fBNg̉̃pXgetPathNotFileNamePart())Ԃ܂B
+PathString getDirectoryKey(const PathString &dir)
+{
+	return getPathChildPrefix(dir);
+}
+
+/// L[fBNg̐efBNg̃L[Ԃ܂BfalseԂ܂B
+bool getParentDirectoryKey(const PathString &key, PathString &parentKey)
+{
+	const PathString dir = getPathWithoutLastRedundantSeparator(key);
+	if(dir.empty() || dir == key){
+		return false;
+	}
+	parentKey = getPathNotFileNamePart(dir);
+	return parentKey != key;
+}
+
+void appendString(std::vector<char> &strings, const PathChar *str, std::size_t length)
+{
+	appendVarint(strings, length);
+	const char * const bytes = reinterpret_cast<const char *>(str);
+	strings.insert(strings.end(), bytes, bytes + length * sizeof(PathChar));
+}
+
+}//namespace
+
+
+// --------------------------------------------------------
+// FileStatDB
+// --------------------------------------------------------
+
+std::uint64_t FileStatDB::hashPath(const PathChar *path, std::size_t length)
+{
+	// FNV-1a
+	std::uint64_t hash = 14695981039346656037ull;
+	for(std::size_t i = 0; i < length; ++i){
+		hash ^= static_cast<unsigned char>(path[i]);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+FileStatDB::FileStatDB()
+	: header_(nullptr)
+	, records_(nullptr)
+	, index_(nullptr)
+	, directories_(nullptr)
+	, childRecords_(nullptr)
+	, subdirectories_(nullptr)
+	, contentHashes_(nullptr)
+	, strings_(nullptr)
+{
+}
+
+bool FileStatDB::open(const PathString &dbFile)
+{
+	close();
+	if(!file_.open(dbFile)){
+		return false;
+	}
+	if(!attach(file_.getData(), file_.getSize())){
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool FileStatDB::assign(std::vector<char> &image)
+{
+	close();
+	image_.swap(image);
+	if(!attach(image_.data(), image_.size())){
+		close();
+		return false;
+	}
+	return true;
+}
+
+void FileStatDB::close()
+{
+	header_ = nullptr;
+	records_ = nullptr;
+	index_ = nullptr;
+	directories_ = nullptr;
+	childRecords_ = nullptr;
+	subdirectories_ = nullptr;
+	contentHashes_ = nullptr;
+	strings_ = nullptr;
+	file_.close();
+	std::vector<char>().swap(image_);
+}
+
+bool FileStatDB::attach(const char *data, std::size_t size)
+{
+	if(size < sizeof(Header)){
+		return false;
+	}
+	const Header *header = reinterpret_cast<const Header *>(data);
+	if(header->magic != DB_MAGIC || header->version != DB_VERSION){
+		return false;
+	}
+	// Bound the counts first so that the ends below cannot overflow.
+	if(header->recordCount > size / sizeof(Record) || header->bucketCount > size / sizeof(std::uint32_t)
+		|| header->directoryCount > size / sizeof(Directory) || header->stringsSize > size
+		|| header->recordsOffset > size || header->indexOffset > size || header->directoriesOffset > size
+		|| header->childRecordsOffset > size || header->subdirectoriesOffset > size
+		|| header->contentHashesOffset > size || header->stringsOffset > size){
+		return false;
+	}
+	const std::uint64_t recordsEnd = header->recordsOffset + header->recordCount * sizeof(Record);
+	const std::uint64_t indexEnd = header->indexOffset + header->bucketCount * sizeof(std::uint32_t);
+	const std::uint64_t directoriesEnd = header->directoriesOffset + header->directoryCount * sizeof(Directory);
+	const std::uint64_t childRecordsEnd = header->childRecordsOffset + header->recordCount * sizeof(std::uint32_t);
+	const std::uint64_t subdirectoriesEnd = header->subdirectoriesOffset + header->directoryCount * sizeof(std::uint32_t);
+	const std::uint64_t contentHashesEnd = header->contentHashesOffset
+		? header->contentHashesOffset + header->recordCount * sizeof(std::uint64_t)
+		: subdirectoriesEnd;
+	const std::uint64_t stringsEnd = header->stringsOffset + header->stringsSize;
+	if(header->recordsOffset < sizeof(Header) || header->recordsOffset % 8 != 0
+		|| header->indexOffset < recordsEnd || header->indexOffset % 4 != 0
+		|| header->directoriesOffset < indexEnd || header->directoriesOffset % 8 != 0
+		|| header->childRecordsOffset < directoriesEnd || header->childRecordsOffset % 4 != 0
+		|| header->subdirectoriesOffset < childRecordsEnd || header->subdirectoriesOffset % 4 != 0
+		|| (header->contentHashesOffset && (header->contentHashesOffset < subdirectoriesEnd || header->contentHashesOffset % 8 != 0))
+		|| header->stringsOffset < contentHashesEnd
+		|| stringsEnd > size
+		|| header->bucketCount != getBucketCount(header->recordCount)){
+		return false;
+	}
+	header_ = header;
+	records_ = reinterpret_cast<const Record *>(data + header->recordsOffset);
+	index_ = reinterpret_cast<const std::uint32_t *>(data + header->indexOffset);
+	directories_ = reinterpret_cast<const Directory *>(data + header->directoriesOffset);
+	childRecords_ = reinterpret_cast<const std::uint32_t *>(data + header->childRecordsOffset);
+	subdirectories_ = reinterpret_cast<const std::uint32_t *>(data + header->subdirectoriesOffset);
+	contentHashes_ = header->contentHashesOffset ? reinterpret_cast<const std::uint64_t *>(data + header->contentHashesOffset) : nullptr;
+	strings_ = data + header->stringsOffset;
+	return isValid();
+}
+
+/**
+ * \̔ԍƕ̃ItZbgSĔ͈͓ǂm߂܂(ꂽDBŔ͈͊Oǂ܂Ȃ悤)B
+ * я͊m߂܂(ĂĂὡ邾ł)B
+ */
+bool FileStatDB::isValid() const
+{
+	const std::uint64_t recordCount = header_->recordCount;
+	const std::uint64_t directoryCount = header_->directoryCount;
+	for(std::uint64_t i = 0; i < recordCount; ++i){
+		const Record &record = records_[i];
+		if(record.directoryIndex >= directoryCount || !isValidString(record.nameOffset)
+			|| childRecords_[i] >= recordCount){
+			return false;
+		}
+	}
+	std::uint64_t usedBuckets = 0;
+	for(std::uint64_t i = 0; i < header_->bucketCount; ++i){
+		if(index_[i] > recordCount){
+			return false;
+		}
+		usedBuckets += index_[i] != 0;
+	}
+	if(usedBuckets != recordCount){
+		return false; // find() relies on empty buckets to stop
+	}
+	for(std::uint64_t i = 0; i < directoryCount; ++i){
+		const Directory &directory = directories_[i];
+		if(!isValidString(directory.pathOffset)
+			|| (directory.parentIndex != NO_PARENT && directory.parentIndex >= directoryCount)
+			|| static_cast<std::uint64_t>(directory.firstChildRecord) + directory.childRecordCount > recordCount
+			|| static_cast<std::uint64_t>(directory.firstSubdirectory) + directory.subdirectoryCount > directoryCount
+			|| subdirectories_[i] >= directoryCount){
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FileStatDB::isValidString(std::uint64_t offset) const
+{
+	if(offset >= header_->stringsSize){
+		return false;
+	}
+	const char *p = strings_ + offset;
+	const char * const end = strings_ + header_->stringsSize;
+	std::uint64_t length;
+	return readVarint(p, end, length) && length <= static_cast<std::uint64_t>(end - p) / sizeof(PathChar);
+}
+
+PathString FileStatDB::getRecordPath(const Record &record) const
+{
+	std::size_t dirLength;
+	const PathChar * const dir = getDirectoryPart(record, dirLength);
+	std::size_t nameLength;
+	const PathChar * const name = getFileNamePart(record, nameLength);
+	PathString path;
+	path.reserve(dirLength + nameLength);
+	path.append(dir, dirLength);
+	path.append(name, nameLength);
+	return path;
+}
+
+PathString FileStatDB::getRecordFileName(const Record &record) const
+{
+	std::size_t nameLength;
+	const PathChar * const name = getFileNamePart(record, nameLength);
+	return PathString(name, nameLength);
+}
+
+PathString FileStatDB::getDirectoryPath(const Directory &dir) const
+{
+	std::size_t length;
+	const PathChar * const path = getString(dir.pathOffset, length);
+	return getPathWithoutLastRedundantSeparator(PathString(path, length));
+}
+
+int FileStatDB::compareRecordPath(const Record &record, const PathString &path) const
+{
+	std::size_t dirLength;
+	const PathChar * const dir = getDirectoryPart(record, dirLength);
+	std::size_t nameLength;
+	const PathChar * const name = getFileNamePart(record, nameLength);
+
+	const int dirOrder = PathCharTraits::compare(dir, path.data(), std::min(dirLength, path.size()));
+	if(dirOrder != 0){
+		return dirOrder;
+	}
+	if(dirLength > path.size()){
+		return 1;
+	}
+	const std::size_t rest = path.size() - dirLength;
+	const int nameOrder = PathCharTraits::compare(name, path.data() + dirLength, std::min(nameLength, rest));
+	if(nameOrder != 0){
+		return nameOrder;
+	}
+	return nameLength < rest ? -1 : nameLength > rest ? 1 : 0;
+}
+
+const FileStatDB::Record *FileStatDB::find(const PathString &path) const
+{
+	if(!header_ || header_->bucketCount == 0){
+		return nullptr;
+	}
+	const std::uint64_t hash = hashPath(path.data(), path.size());
+	const std::uint64_t mask = header_->bucketCount - 1;
+	for(std::uint64_t bucket = hash & mask; ; bucket = (bucket + 1) & mask){
+		const std::uint32_t slot = index_[bucket];
+		if(slot == 0){
+			return nullptr;
+		}
+		const Record &record = records_[slot - 1];
+		if(record.pathHash == static_cast<std::uint32_t>(hash)
+			&& compareRecordPath(record, path) == 0){
+			return &record;
+		}
+	}
+}
+
+const FileStatDB::Directory *FileStatDB::findScannedDirectory(const PathString &dir) const
+{
+	if(!header_){
+		return nullptr;
+	}
+	const PathString key = getDirectoryKey(dir);
+	// the directory table is sorted by path
+	std::size_t lo = 0;
+	std::size_t hi = static_cast<std::size_t>(header_->directoryCount);
+	while(lo < hi){
+		const std::size_t mid = lo + (hi - lo) / 2;
+		std::size_t length;
+		const PathChar * const path = getString(directories_[mid].pathOffset, length);
+		int order = PathCharTraits::compare(path, key.data(), std::min(length, key.size()));
+		if(order == 0){
+			order = length < key.size() ? -1 : length > key.size() ? 1 : 0;
+		}
+		if(order == 0){
+			return (directories_[mid].flags & DIRFLAG_SCANNED) ? &directories_[mid] : nullptr;
+		}
+		if(order < 0){
+			lo = mid + 1;
+		}
+		else{
+			hi = mid;
+		}
+	}
+	return nullptr;
+}
+
+
+// --------------------------------------------------------
+// FileStatDBBuilder
+// --------------------------------------------------------
+
+void FileStatDBBuilder::add(const PathString &path, FileType fileType, FileSize fileSize, FileTime lastWriteTime, std::uint64_t contentHash)
+{
+	Item item;
+	item.path = PathSlice::copy(arena_, path);
+	item.namePos = getPathFileNamePos(path);
+	item.fileType = fileType;
+	item.fileSize = fileSize;
+	item.lastWriteTime = lastWriteTime;
+	item.contentHash = contentHash;
+	items_.push_back(item);
+}
+
+void FileStatDBBuilder::addScannedDirectory(const PathString &dir, FileTime lastWriteTime)
+{
+	ScannedDirectory scanned;
+	scanned.key = PathSlice::copy(arena_, getDirectoryKey(dir));
+	scanned.lastWriteTime = lastWriteTime;
+	scannedDirectories_.push_back(scanned);
+}
+
+bool FileStatDBBuilder::build(std::vector<char> &image)
+{
+	// Records are numbered from 1 in the index, and NO_PARENT is not a directory number.
+	if(items_.size() >= std::numeric_limits<std::uint32_t>::max()){
+		return false;
+	}
+
+	std::stable_sort(items_.begin(), items_.end(),
+		[](const Item &a, const Item &b){ return a.path < b.path;});
+
+	// Directory table, sorted by path: directories of the records and the scanned directories.
+	// The keys refer to the strings in arena_ (a record's key is the head of its path).
+	typedef std::pair<const PathSlice, FileStatDB::Directory> DirectoryMapValue;
+	typedef std::map<PathSlice, FileStatDB::Directory, std::less<PathSlice>, ArenaAllocator<DirectoryMapValue>> DirectoryMap;
+	MonotonicArena workArena;
+	const ArenaAllocator<DirectoryMapValue> workAllocator(workArena);
+	DirectoryMap directoryMap(std::less<PathSlice>(), workAllocator);
+	const auto getItemDirectoryKey = [](const Item &item){ const PathSlice key = {item.path.data, item.namePos}; return key;};
+	for(const Item &item : items_){
+		directoryMap[getItemDirectoryKey(item)];
+	}
+	for(const ScannedDirectory &scanned : scannedDirectories_){
+		FileStatDB::Directory &directory = directoryMap[scanned.key];
+		directory.lastWriteTime = scanned.lastWriteTime;
+		directory.flags |= FileStatDB::DIRFLAG_SCANNED;
+	}
+	if(directoryMap.size() >= FileStatDB::NO_PARENT){
+		return false;
+	}
+	std::vector<FileStatDB::Directory> directories;
+	directories.reserve(directoryMap.size());
+	std::vector<char> strings;
+	for(auto &keyDirectory : directoryMap){
+		FileStatDB::Directory &directory = keyDirectory.second;
+		directory.pathOffset = strings.size();
+		directory.parentIndex = static_cast<std::uint32_t>(directories.size()); // the map keeps the own index here
+		appendString(strings, keyDirectory.first.data, keyDirectory.first.size);
+		directories.push_back(directory);
+	}
+	for(auto &keyDirectory : directoryMap){
+		FileStatDB::Directory &directory = directories[keyDirectory.second.parentIndex];
+		directory.parentIndex = FileStatDB::NO_PARENT;
+		PathString parentKey;
+		if(getParentDirectoryKey(keyDirectory.first.str(), parentKey)){
+			const auto parent = directoryMap.find(PathSlice::of(parentKey));
+			if(parent != directoryMap.end()){
+				directory.parentIndex = parent->second.parentIndex;
+			}
+		}
+	}
+
+	// Split each path into the directory part and the file name part.
+	std::vector<FileStatDB::Record> records(items_.size());
+	auto dirIt = directoryMap.end();
+	for(std::size_t i = 0; i < items_.size(); ++i){
+		const Item &item = items_[i];
+		const PathSlice dirKey = getItemDirectoryKey(item);
+		if(dirIt == directoryMap.end() || dirIt->first != dirKey){
+			dirIt = directoryMap.find(dirKey);
+		}
+
+		if(strings.size() > std::numeric_limits<std::uint32_t>::max()){
+			return false; // nameOffset is 32 bits
+		}
+		FileStatDB::Record &record = records[i];
+		record.fileSize = item.fileSize;
+		record.lastWriteTime = item.lastWriteTime;
+		record.pathHash = static_cast<std::uint32_t>(FileStatDB::hashPath(item.path.data, item.path.size));
+		record.directoryIndex = dirIt->second.parentIndex; // the own index (see above)
+		record.nameOffset = static_cast<std::uint32_t>(strings.size());
+		record.fileType = item.fileType;
+		appendString(strings, item.path.data + item.namePos, item.path.size - item.namePos);
+	}
+
+	// Group the records by directory and the directories by parent (counting sort).
+	std::vector<std::uint32_t> childRecords(records.size());
+	for(const FileStatDB::Record &record : records){
+		++directories[record.directoryIndex].childRecordCount;
+	}
+	std::vector<std::uint32_t> subdirectories;
+	for(const FileStatDB::Directory &directory : directories){
+		if(directory.parentIndex != FileStatDB::NO_PARENT && (directory.flags & FileStatDB::DIRFLAG_SCANNED)){
+			++directories[directory.parentIndex].subdirectoryCount;
+		}
+	}
+	std::uint32_t childRecordPos = 0;
+	std::uint32_t subdirectoryPos = 0;
+	for(FileStatDB::Directory &directory : directories){
+		directory.firstChildRecord = childRecordPos;
+		directory.firstSubdirectory = subdirectoryPos;
+		childRecordPos += directory.childRecordCount;
+		subdirectoryPos += directory.subdirectoryCount;
+		directory.childRecordCount = 0;
+		directory.subdirectoryCount = 0;
+	}
+	subdirectories.resize(subdirectoryPos);
+	for(std::size_t i = 0; i < records.size(); ++i){
+		FileStatDB::Directory &directory = directories[records[i].directoryIndex];
+		childRecords[directory.firstChildRecord + directory.childRecordCount++] = static_cast<std::uint32_t>(i);
+	}
+	for(std::size_t i = 0; i < directories.size(); ++i){
+		if(directories[i].parentIndex != FileStatDB::NO_PARENT && (directories[i].flags & FileStatDB::DIRFLAG_SCANNED)){
+			FileStatDB::Directory &parent = directories[directories[i].parentIndex];
+			subdirectories[parent.firstSubdirectory + parent.subdirectoryCount++] = static_cast<std::uint32_t>(i);
+		}
+	}
+
+	FileStatDB::Header header;
+	header.magic = FileStatDB::DB_MAGIC;
+	header.version = FileStatDB::DB_VERSION;
+	header.recordCount = records.size();
+	header.bucketCount = getBucketCount(header.recordCount);
+	header.directoryCount = directories.size();
+	header.recordsOffset = alignUp(sizeof(FileStatDB::Header), 8);
+	header.indexOffset = header.recordsOffset + header.recordCount * sizeof(FileStatDB::Record);
+	header.directoriesOffset = alignUp(header.indexOffset + header.bucketCount * sizeof(std::uint32_t), 8);
+	header.childRecordsOffset = header.directoriesOffset + header.directoryCount * sizeof(FileStatDB::Directory);
+	header.subdirectoriesOffset = header.childRecordsOffset + header.recordCount * sizeof(std::uint32_t);
+	const std::uint64_t subdirectoriesEnd = header.subdirectoriesOffset + header.directoryCount * sizeof(std::uint32_t);
+	header.contentHashesOffset = contentHashEnabled_ ? alignUp(subdirectoriesEnd, 8) : 0;
+	header.stringsOffset = contentHashEnabled_ ? header.contentHashesOffset + header.recordCount * sizeof(std::uint64_t) : subdirectoriesEnd;
+	header.stringsSize = strings.size();
+
+	image.assign(static_cast<std::size_t>(header.stringsOffset + header.stringsSize), 0);
+	char * const data = image.data();
+	std::memcpy(data, &header, sizeof(header));
+	if(!records.empty()){
+		std::memcpy(data + header.recordsOffset, records.data(), records.size() * sizeof(FileStatDB::Record));
+		std::memcpy(data + header.childRecordsOffset, childRecords.data(), childRecords.size() * sizeof(std::uint32_t));
+	}
+	if(!directories.empty()){
+		std::memcpy(data + header.directoriesOffset, directories.data(), directories.size() * sizeof(FileStatDB::Directory));
+	}
+	if(!subdirectories.empty()){
+		std::memcpy(data + header.subdirectoriesOffset, subdirectories.data(), subdirectories.size() * sizeof(std::uint32_t));
+	}
+	if(contentHashEnabled_){
+		std::uint64_t * const contentHashes = reinterpret_cast<std::uint64_t *>(data + header.contentHashesOffset);
+		for(std::size_t i = 0; i < items_.size(); ++i){
+			contentHashes[i] = items_[i].contentHash;
+		}
+	}
+	if(!strings.empty()){
+		std::memcpy(data + header.stringsOffset, strings.data(), strings.size());
+	}
+
+	std::uint32_t * const index = reinterpret_cast<std::uint32_t *>(data + header.indexOffset);
+	const std::uint64_t mask = header.bucketCount - 1;
+	for(std::size_t i = 0; i < records.size(); ++i){
+		std::uint64_t bucket = FileStatDB::hashPath(items_[i].path.data, items_[i].path.size) & mask;
+		while(index[bucket] != 0){
+			bucket = (bucket + 1) & mask;
+		}
+		index[bucket] = static_cast<std::uint32_t>(i + 1);
+	}
+	return true;
+}
+
+}//namespace detfc
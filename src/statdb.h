@@ -0,0 +1,208 @@
+#ifndef DETFC_STATDB_H_INCLUDED
+#define DETFC_STATDB_H_INCLUDED
+
+#include <vector>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+#include "filesystem.h"
+#include "binaryio.h"
+#include "arena.h"
+
+namespace detfc{
+
+/**
+ * filestatp̃nbVtDBt@CłB
+ *
+ * t@C͓ǂݍݐpŃɃ}bvÂ܂܂̌`ŎQƂ܂B
+ * JƂ͊eR[h̔ԍƃItZbg͈͓ǂm߁ApX̕Ȃǂ͕܂B
+ *
+ * pX̓fBNg(Ō̋؂蕶܂)ƃt@CɕĊi[܂B
+ * fBNg̓fBNg\Ɉxi[AeR[h͂̔ԍƃt@C܂B
+ * ͒(LEB128)̌ɕׂ`łB
+ *
+ * fBNg\ɂ́AfBNg̍XVƁÃR[hETufBNg̈ꗗ܂B
+ * XVςĂȂfBNg͒̃GgςĂȂ̂ŁA񋓂ɂ̈ꗗg܂B
+ *
+ * `:
+ * - Header
+ * - Record[recordCount] (pX)
+ * - std::uint32_t index[bucketCount] (pXnbVɂI[vAhX@̍Bl̓R[hԍ+1A0͋)
+ * - Directory[directoryCount] (pX)
+ * - std::uint32_t childRecords[recordCount] (fBNgɂ܂Ƃ߂R[hԍ)
+ * - std::uint32_t subdirectories[directoryCount] (efBNgɂ܂Ƃ߂fBNgԍ)
+ * - std::uint64_t contentHashes[recordCount] (ẽnbVlBcontentHashesOffset0̂Ƃ͖)
+ * - char strings[stringsSize] (fBNgƃt@C̕)
+ */
+class FileStatDB
+{
+public:
+	static const std::uint32_t DB_MAGIC = 'd'|('f'<<8)|('x'<<16)|('2'<<24);
+	static const std::uint32_t DB_VERSION = 4;
+	static const std::uint32_t NO_PARENT = ~0u;
+
+	struct Header
+	{
+		std::uint32_t magic;
+		std::uint32_t version;
+		std::uint64_t recordCount;
+		std::uint64_t bucketCount;
+		std::uint64_t directoryCount;
+		std::uint64_t recordsOffset;
+		std::uint64_t indexOffset;
+		std::uint64_t directoriesOffset;
+		std::uint64_t childRecordsOffset;
+		std::uint64_t subdirectoriesOffset;
+		std::uint64_t contentHashesOffset;
+		std::uint64_t stringsOffset;
+		std::uint64_t stringsSize;
+	};
+	struct Record
+	{
+		std::uint64_t fileSize;
+		std::uint64_t lastWriteTime;
+		std::uint32_t pathHash; ///< lower 32 bits of hashPath()
+		std::uint32_t directoryIndex;
+		std::uint32_t nameOffset;
+		std::uint32_t fileType;
+	};
+	enum DirectoryFlag
+	{
+		DIRFLAG_SCANNED = 1 ///< 񋓂fBNg(lastWriteTimeƒ̈ꗗL)
+	};
+	struct Directory
+	{
+		std::uint64_t pathOffset; ///< Ō̋؂蕶܂ł܂ރpX
+		std::uint64_t lastWriteTime;
+		std::uint32_t parentIndex; ///< NO_PARENT: efBNg͕\ɖ
+		std::uint32_t flags;
+		std::uint32_t firstChildRecord;
+		std::uint32_t childRecordCount;
+		std::uint32_t firstSubdirectory;
+		std::uint32_t subdirectoryCount;
+	};
+
+	static std::uint64_t hashPath(const PathChar *path, std::size_t length);
+
+private:
+	MappedFile file_;
+	std::vector<char> image_;
+	const Header *header_;
+	const Record *records_;
+	const std::uint32_t *index_;
+	const Directory *directories_;
+	const std::uint32_t *childRecords_;
+	const std::uint32_t *subdirectories_;
+	const std::uint64_t *contentHashes_;
+	const char *strings_;
+
+public:
+	FileStatDB();
+
+	/**
+	 * DBt@C}bv܂B`قȂꍇĂꍇfalseԂ܂B
+	 */
+	bool open(const PathString &dbFile);
+	/**
+	 * FileStatDBBuilderō쐬C[Wg܂B
+	 */
+	bool assign(std::vector<char> &image);
+	void close();
+
+	std::size_t getRecordCount() const { return header_ ? static_cast<std::size_t>(header_->recordCount) : 0;}
+	const Record &getRecord(std::size_t i) const { return records_[i];}
+	std::size_t getRecordIndex(const Record &record) const { return &record - records_;}
+	PathString getRecordPath(const Record &record) const;
+	FileType getRecordFileType(const Record &record) const { return static_cast<FileType>(record.fileType);}
+	bool hasContentHash() const { return contentHashes_ != nullptr;}
+	std::uint64_t getRecordContentHash(const Record &record) const { return contentHashes_[getRecordIndex(record)];}
+
+	/**
+	 * R[h̃pXpathr܂(PathString̑召֌WƓł)B
+	 */
+	int compareRecordPath(const Record &record, const PathString &path) const;
+
+	/**
+	 * path̃R[hT܂B̊mۂ͍s܂B
+	 */
+	const Record *find(const PathString &path) const;
+
+	/**
+	 * fBNgdiȑT܂(dir͖̋؂蕶̗L₢܂)B
+	 */
+	const Directory *findScannedDirectory(const PathString &dir) const;
+	std::size_t getChildRecordCount(const Directory &dir) const { return dir.childRecordCount;}
+	const Record &getChildRecord(const Directory &dir, std::size_t i) const { return records_[childRecords_[dir.firstChildRecord + i]];}
+	std::size_t getSubdirectoryCount(const Directory &dir) const { return dir.subdirectoryCount;}
+	const Directory &getSubdirectory(const Directory &dir, std::size_t i) const { return directories_[subdirectories_[dir.firstSubdirectory + i]];}
+	/// fBNg̃pXԂ܂(̋؂蕶͊܂݂܂)B
+	PathString getDirectoryPath(const Directory &dir) const;
+	/// R[h̃t@CԂ܂B
+	PathString getRecordFileName(const Record &record) const;
+
+private:
+	bool attach(const char *data, std::size_t size);
+	bool isValid() const;
+	bool isValidString(std::uint64_t offset) const;
+	const PathChar *getString(std::uint64_t offset, std::size_t &length) const
+	{
+		const char *p = strings_ + offset;
+		length = static_cast<std::size_t>(readVarint(p));
+		return reinterpret_cast<const PathChar *>(p);
+	}
+	const PathChar *getDirectoryPart(const Record &record, std::size_t &length) const
+	{
+		return getString(directories_[record.directoryIndex].pathOffset, length);
+	}
+	const PathChar *getFileNamePart(const Record &record, std::size_t &length) const
+	{
+		return getString(record.nameOffset, length);
+	}
+};
+
+
+/**
+ * FileStatDB̃C[W쐬܂B
+ *
+ * ǉꂽpXƗp̕\̓A[iɒuAr_[ƋɈxɉ܂B
+ */
+class FileStatDBBuilder
+{
+	struct Item
+	{
+		PathSlice path;
+		std::size_t namePos; ///< t@C̐擪
+		FileType fileType;
+		FileSize fileSize;
+		FileTime lastWriteTime;
+		std::uint64_t contentHash;
+	};
+	struct ScannedDirectory
+	{
+		PathSlice key; ///< getDirectoryKey()
+		FileTime lastWriteTime;
+	};
+	MonotonicArena arena_;
+	std::vector<Item> items_;
+	std::vector<ScannedDirectory> scannedDirectories_;
+	bool contentHashEnabled_;
+public:
+	FileStatDBBuilder() : contentHashEnabled_(false) {}
+	void reserve(std::size_t count) { items_.reserve(count);}
+	/// ẽnbVl̗o͂邩ǂw肵܂B
+	void setContentHashEnabled(bool enabled) { contentHashEnabled_ = enabled;}
+	void add(const PathString &path, FileType fileType, FileSize fileSize, FileTime lastWriteTime, std::uint64_t contentHash = 0);
+	/**
+	 * fBNgǉ܂B̃Gg͑Sadd()邩AaddScannedDirectory()ĂB
+	 */
+	void addScannedDirectory(const PathString &dir, FileTime lastWriteTime);
+
+	/**
+	 * C[W쐬܂BR[h̓pXɕבւ܂B
+	 * \`̏(32rbg̔ԍƃItZbg)𒴂ƂfalseԂ܂B
+	 */
+	bool build(std::vector<char> &image);
+};
+
+}//namespace detfc
+#endif
@@ -0,0 +1,141 @@
+#include "threadpool.h"
+
+namespace detfc{
+
+const unsigned int WorkStealingThreadPool::NO_WORKER;
+
+WorkStealingThreadPool::WorkStealingThreadPool(unsigned int threadCount)
+	: queuedCount_(0)
+	, pendingCount_(0)
+	, nextWorker_(0)
+	, cancelled_(false)
+	, stopping_(false)
+{
+	if(threadCount == 0){
+		threadCount = 1;
+	}
+	for(unsigned int i = 0; i < threadCount; ++i){
+		workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+	}
+	for(unsigned int i = 0; i < threadCount; ++i){
+		threads_.push_back(std::thread(&WorkStealingThreadPool::run, this, i));
+	}
+}
+
+WorkStealingThreadPool::~WorkStealingThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	taskAvailable_.notify_all();
+	for(std::thread &t : threads_){
+		t.join();
+	}
+}
+
+void WorkStealingThreadPool::submit(const Task &task, unsigned int workerIndex)
+{
+	if(cancelled_){
+		return;
+	}
+	if(workerIndex >= workers_.size()){
+		workerIndex = nextWorker_++ % workers_.size();
+	}
+	++pendingCount_;
+	{
+		// Count the task before it can be taken or discarded by cancel(), so that queuedCount_ never goes below zero.
+		std::lock_guard<std::mutex> lock(mutex_);
+		++queuedCount_;
+		Worker &worker = *workers_[workerIndex];
+		std::lock_guard<std::mutex> workerLock(worker.mutex);
+		worker.tasks.push_back(task);
+	}
+	taskAvailable_.notify_one();
+}
+
+void WorkStealingThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while(pendingCount_ != 0){
+		allDone_.wait(lock);
+	}
+}
+
+void WorkStealingThreadPool::cancel()
+{
+	cancelled_ = true;
+	std::size_t discarded = 0;
+	for(std::unique_ptr<Worker> &worker : workers_){
+		std::lock_guard<std::mutex> lock(worker->mutex);
+		discarded += worker->tasks.size();
+		worker->tasks.clear();
+	}
+	if(discarded == 0){
+		return;
+	}
+	queuedCount_ -= discarded;
+	if((pendingCount_ -= discarded) == 0){
+		std::lock_guard<std::mutex> lock(mutex_);
+		allDone_.notify_all();
+	}
+}
+
+void WorkStealingThreadPool::run(unsigned int workerIndex)
+{
+	Task task;
+	for(;;){
+		if(takeTask(workerIndex, task)){
+			task(workerIndex);
+			task = Task();
+			finishTask();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		while(queuedCount_ == 0 && !stopping_){
+			taskAvailable_.wait(lock);
+		}
+		if(stopping_){
+			return;
+		}
+	}
+}
+
+bool WorkStealingThreadPool::takeTask(unsigned int workerIndex, Task &task)
+{
+	// own queue: LIFO (depth first, cache friendly)
+	{
+		Worker &worker = *workers_[workerIndex];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if(!worker.tasks.empty()){
+			task.swap(worker.tasks.back());
+			worker.tasks.pop_back();
+			--queuedCount_;
+			return true;
+		}
+	}
+	// steal: FIFO (larger subtrees first)
+	const std::size_t count = workers_.size();
+	for(std::size_t i = 1; i < count; ++i){
+		Worker &victim = *workers_[(workerIndex + i) % count];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if(!victim.tasks.empty()){
+			task.swap(victim.tasks.front());
+			victim.tasks.pop_front();
+			--queuedCount_;
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkStealingThreadPool::finishTask()
+{
+	if(--pendingCount_ == 0){
+		std::lock_guard<std::mutex> lock(mutex_);
+		allDone_.notify_all();
+	}
+}
+
+}//namespace detfc
@@ -0,0 +1,77 @@
+#ifndef DETFC_THREADPOOL_H_INCLUDED
+#define DETFC_THREADPOOL_H_INCLUDED
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace detfc{
+
+/**
+ * [NXeB[ÕXbhv[łB
+ *
+ * e[J[͎̃L[̖^XNoAɂȂ瑼̃[J[̃L[̐擪瓐݂܂B
+ * ^XNɂ͎sĂ郏[J[̔ԍn܂B^XN̒瓊^XN͂̃[J[̃L[ɐς܂܂B
+ */
+class WorkStealingThreadPool
+{
+public:
+	typedef std::function<void(unsigned int workerIndex)> Task;
+	static const unsigned int NO_WORKER = ~0u;
+
+	explicit WorkStealingThreadPool(unsigned int threadCount);
+	~WorkStealingThreadPool();
+
+	unsigned int getThreadCount() const { return static_cast<unsigned int>(workers_.size());}
+
+	/**
+	 * ^XN𓊓܂B
+	 * ^XN̒ĂяoƂ́Ã^XNɓnꂽworkerIndexw肵ĂB
+	 */
+	void submit(const Task &task, unsigned int workerIndex = NO_WORKER);
+
+	/**
+	 * ꂽSẴ^XN(^XN瓊ꂽ̂܂)I܂ő҂܂B
+	 */
+	void wait();
+
+	/**
+	 * L[ɎcĂ^XNjAȍ~ɓ^XN܂B
+	 * s̃^XN͎~߂Ȃ̂ŁA^XNłisCancelled()Ȃǂđ߂ɏI悤ɂĂB
+	 */
+	void cancel();
+	bool isCancelled() const { return cancelled_;}
+
+private:
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::vector<std::thread> threads_;
+
+	std::mutex mutex_;
+	std::condition_variable taskAvailable_;
+	std::condition_variable allDone_;
+	std::atomic<std::size_t> queuedCount_;
+	std::atomic<std::size_t> pendingCount_;
+	std::atomic<unsigned int> nextWorker_;
+	std::atomic<bool> cancelled_;
+	bool stopping_;
+
+	WorkStealingThreadPool(const WorkStealingThreadPool &);
+	WorkStealingThreadPool &operator=(const WorkStealingThreadPool &);
+
+	void run(unsigned int workerIndex);
+	bool takeTask(unsigned int workerIndex, Task &task);
+	void finishTask();
+};
+
+}//namespace detfc
+#endif
@@ -0,0 +1,217 @@
+#include <map>
+#include "watcher.h"
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace detfc{
+
+#if defined(__linux__)
+
+// --------------------------------------------------------
+// FileWatcher (inotify)
+// --------------------------------------------------------
+
+class FileWatcher::Impl
+{
+	static const std::uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE
+		| IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+	static const std::uint32_t SUBTREE_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+	static const std::size_t BUFFER_SIZE = 64 * 1024;
+
+	struct Watch
+	{
+		PathString dir;
+		bool recursive;
+	};
+	int fd_;
+	std::map<int, Watch> watches_;
+	std::vector<Watch> roots_;
+	std::unique_ptr<char[]> buffer_;
+	std::map<PathString, bool> changes_; ///< path => subtree
+public:
+	Impl()
+		: fd_(::inotify_init1(IN_CLOEXEC))
+		, buffer_(new char[BUFFER_SIZE])
+	{}
+	~Impl()
+	{
+		if(fd_ != -1){
+			::close(fd_);
+		}
+	}
+
+	bool addDirectory(const PathString &dir, bool recursive)
+	{
+		Watch root = {dir, recursive};
+		roots_.push_back(root);
+		return addWatch(dir, recursive);
+	}
+
+	bool waitChanges(std::vector<Change> &changes, unsigned int debounceMs)
+	{
+		return collectChanges(changes, -1, static_cast<int>(debounceMs));
+	}
+	bool readPendingChanges(std::vector<Change> &changes)
+	{
+		return collectChanges(changes, 0, 0);
+	}
+
+private:
+	bool collectChanges(std::vector<Change> &changes, int firstTimeout, int debounceMs)
+	{
+		if(fd_ == -1){
+			return false;
+		}
+		changes_.clear();
+		int timeout = firstTimeout;
+		for(;;){
+			struct pollfd pfd = {fd_, POLLIN, 0};
+			const int result = ::poll(&pfd, 1, timeout);
+			if(result < 0){
+				if(errno == EINTR){
+					continue;
+				}
+				return false;
+			}
+			if(result == 0){
+				break; // quiet for debounceMs
+			}
+			if(!readEvents()){
+				return false;
+			}
+			if(!changes_.empty()){
+				timeout = debounceMs;
+			}
+		}
+
+		changes.clear();
+		changes.reserve(changes_.size());
+		for(const auto &pathSubtree : changes_){
+			Change change = {pathSubtree.first, pathSubtree.second};
+			changes.push_back(change);
+		}
+		return true;
+	}
+	bool addWatch(const PathString &dir, bool recursive)
+	{
+		if(fd_ == -1){
+			return false;
+		}
+		const int wd = ::inotify_add_watch(fd_, dir.empty() ? "." : dir.c_str(), WATCH_MASK);
+		if(wd == -1){
+			return false;
+		}
+		Watch watch = {dir, recursive};
+		watches_[wd] = watch;
+		if(recursive){
+			for(DirectoryEntryEnumerator etor(dir.empty() ? PathString(".") : dir, FILEATTR_TYPE); !etor.isEnd(); etor.increment()){
+				const DirectoryEntry &entry = etor.getEntry();
+				if(entry.isDirectory()){
+					addWatch(concatPath(dir, entry.getFilename()), true);
+				}
+			}
+		}
+		return true;
+	}
+	void removeWatchesUnder(const PathString &dir)
+	{
+		for(auto it = watches_.begin(); it != watches_.end(); ){
+			if(it->second.dir == dir || isPathUnderDirectory(it->second.dir, dir)){
+				::inotify_rm_watch(fd_, it->first);
+				it = watches_.erase(it);
+			}
+			else{
+				++it;
+			}
+		}
+	}
+	void addChange(const PathString &path, bool subtree)
+	{
+		bool &s = changes_[path];
+		s = s || subtree;
+	}
+	bool readEvents()
+	{
+		ssize_t size;
+		while((size = ::read(fd_, buffer_.get(), BUFFER_SIZE)) < 0){
+			if(errno != EINTR){
+				return false;
+			}
+		}
+		for(const char *p = buffer_.get(); p < buffer_.get() + size; ){
+			const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+			p += sizeof(struct inotify_event) + event->len;
+
+			if(event->mask & IN_Q_OVERFLOW){
+				// Events were lost. Everything under the roots has to be checked again.
+				for(const Watch &root : roots_){
+					addChange(root.dir, true);
+				}
+				continue;
+			}
+			auto it = watches_.find(event->wd);
+			if(it == watches_.end()){
+				continue;
+			}
+			if(event->mask & IN_IGNORED){
+				watches_.erase(it);
+				continue;
+			}
+			if(event->len == 0){
+				continue; // the watched directory itself. reported by the parent.
+			}
+			const Watch watch = it->second;
+			const PathString path = concatPath(watch.dir, event->name);
+			const bool isDir = (event->mask & IN_ISDIR) != 0;
+			const bool subtree = isDir && (event->mask & SUBTREE_MASK) != 0;
+			if(isDir && watch.recursive){
+				if(event->mask & (IN_DELETE | IN_MOVED_FROM)){
+					removeWatchesUnder(path);
+				}
+				if(event->mask & (IN_CREATE | IN_MOVED_TO)){
+					addWatch(path, true); // before rescanning, so nothing created in it is missed
+				}
+			}
+			addChange(path, subtree);
+		}
+		return true;
+	}
+};
+
+const std::uint32_t FileWatcher::Impl::WATCH_MASK;
+const std::uint32_t FileWatcher::Impl::SUBTREE_MASK;
+const std::size_t FileWatcher::Impl::BUFFER_SIZE;
+
+bool FileWatcher::isSupported() { return true;}
+
+#else
+
+// --------------------------------------------------------
+// FileWatcher (not supported)
+// --------------------------------------------------------
+
+class FileWatcher::Impl
+{
+public:
+	bool addDirectory(const PathString &, bool) { return false;}
+	bool waitChanges(std::vector<Change> &, unsigned int) { return false;}
+	bool readPendingChanges(std::vector<Change> &) { return false;}
+};
+
+bool FileWatcher::isSupported() { return false;}
+
+#endif
+
+
+FileWatcher::FileWatcher() : impl_(new Impl()) {}
+FileWatcher::~FileWatcher() {}
+bool FileWatcher::addDirectory(const PathString &dir, bool recursive) { return impl_->addDirectory(dir, recursive);}
+bool FileWatcher::waitChanges(std::vector<Change> &changes, unsigned int debounceMs) { return impl_->waitChanges(changes, debounceMs);}
+bool FileWatcher::readPendingChanges(std::vector<Change> &changes) { return impl_->readPendingChanges(changes);}
+
+}//namespace detfc
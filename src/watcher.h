@@ -0,0 +1,56 @@
+#ifndef DETFC_WATCHER_H_INCLUDED
+#define DETFC_WATCHER_H_INCLUDED
+
+#include <vector>
+#include <memory>
+#include "filesystem.h"
+
+namespace detfc{
+
+/**
+ * fBNg̃Gg̕ωĎ܂B
+ *
+ * Linuxłinotifyg܂BȊO̊ɂ͑ΉĂ܂(isSupported()falseԂ܂)B
+ */
+class FileWatcher
+{
+public:
+	struct Change
+	{
+		PathString path;
+		bool subtree; ///< fBNg쐬E폜Eړꂽ(̃GgSĒגKv)
+	};
+
+	FileWatcher();
+	~FileWatcher();
+
+	static bool isSupported();
+
+	/**
+	 * dir̒̃GgĎ܂B
+	 * recursivêƂ̓TufBNgĎAォꂽTufBNgIɊĎɉ܂B
+	 * ωGg̃pXconcatPath(dir, ...)̌`ŕ񍐂܂B
+	 */
+	bool addDirectory(const PathString &dir, bool recursive);
+
+	/**
+	 * ω҂܂B
+	 * ŏ̕ωNAdebounceMs̊ԐVωȂ܂ő҂āÅԂ̕ω܂Ƃ߂ĕԂ܂B
+	 * pX̕ω͈ɂ܂Ƃ߂܂B
+	 */
+	bool waitChanges(std::vector<Change> &changes, unsigned int debounceMs);
+	/**
+	 * ɋNĂω҂Ɏo܂B
+	 */
+	bool readPendingChanges(std::vector<Change> &changes);
+
+private:
+	FileWatcher(const FileWatcher &);
+	FileWatcher &operator=(const FileWatcher &);
+
+	class Impl;
+	std::unique_ptr<Impl> impl_;
+};
+
+}//namespace detfc
+#endif